@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+// bump allocator for scratch memory that is only needed while one task runs.
+// everything is given back at once by reset(), which keeps the blocks for the
+// next task, so that a thread stops allocating after its first few tasks
+class arena {
+  std::vector<std::unique_ptr<char[]>> _blocks;
+  std::vector<size_t> _sizes;
+  size_t _block, _used;
+  size_t _min_block_size;
+public:
+  explicit arena(size_t min_block_size = 1 << 16)
+    : _block(0)
+    , _used(0)
+    , _min_block_size(min_block_size) {
+  }
+
+  // `count` uninitialised Ts
+  template <typename T>
+  T* alloc(size_t count) {
+    static_assert(std::is_trivially_destructible<T>::value
+        , "arena memory is never destructed");
+    size_t size = count * sizeof(T), align = alignof(T);
+    for (;; _block++, _used = 0) {
+      if (_block == _blocks.size()) {
+        _sizes.push_back(std::max(_min_block_size, size + align));
+        _blocks.emplace_back(new char[_sizes.back()]);
+      }
+      size_t offset = (_used + align - 1) / align * align;
+      if (offset + size <= _sizes[_block]) {
+        _used = offset + size;
+        return (T*)(_blocks[_block].get() + offset);
+      }
+    }
+  }
+
+  void reset() {
+    _block = 0;
+    _used = 0;
+  }
+};
+
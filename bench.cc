@@ -0,0 +1,205 @@
+#include "bench.hh"
+#include "image.hh"
+#include "utils.hh"
+#include <algorithm>
+#include <cstdarg>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+struct bench_case {
+  const char *scene;
+  int width, height;
+  int samples, bounces;
+};
+
+// frames before timing starts, for lazy allocations and uploads
+static const int warmup_frames = 3;
+
+static std::vector<bench_case> bench_cases() {
+  static const char *scenes[] = { "cornell", "spheres:64", "spheres:1024" };
+  static const int sizes[][2] = { { 640, 480 }, { 1280, 720 }
+    , { 1920, 1080 } };
+  // short paths with one sample, the interactive default
+  static const int settings[][2] = { { 1, 4 }, { 10, 8 } };
+  std::vector<bench_case> cases;
+  for (const char *scene : scenes)
+    for (const auto &size : sizes)
+      for (const auto &setting : settings)
+        cases.push_back({ scene, size[0], size[1], setting[0], setting[1] });
+  return cases;
+}
+
+struct stats {
+  double min, median, p99;
+};
+
+static stats get_stats(std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  size_t n = values.size();
+  // nearest rank
+  size_t p99 = (size_t)std::ceil(0.99 * n) - 1;
+  return { values[0], n % 2 ? values[n / 2]
+    : 0.5 * (values[n / 2 - 1] + values[n / 2]), values[p99] };
+}
+
+static std::string json_string(const std::string &s) {
+  std::string quoted = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\')
+      quoted += '\\';
+    quoted += c;
+  }
+  return quoted + "\"";
+}
+
+static std::string format(const char *fmt, ...) {
+  char buffer[256];
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(buffer, sizeof(buffer), fmt, args);
+  va_end(args);
+  return buffer;
+}
+
+static std::string json_stats(const char *name, const stats &s) {
+  return format("      \"%s\": { \"min\": %.4f, \"median\": %.4f, "
+      "\"p99\": %.4f }", name, s.min, s.median, s.p99);
+}
+
+void run_bench(const std::function<renderer*(int width, int height)> &create
+    , int runs, const std::string &mode, const std::string &filename) {
+  std::vector<bench_case> cases = bench_cases();
+  std::string name, json_cases;
+  for (size_t c = 0; c < cases.size(); c++) {
+    const bench_case &bc = cases[c];
+    printf("%zu/%zu: %s %dx%d, %d samples, %d bounces\n", c + 1, cases.size()
+        , bc.scene, bc.width, bc.height, bc.samples, bc.bounces);
+    fflush(stdout);
+    scene world;
+    load_scene(bc.scene, &world);
+
+    std::vector<double> ms(runs);
+    renderer *r = create(bc.width, bc.height);
+    name = r->get_name();
+    for (int i = 0; i < warmup_frames + runs; i++) {
+      auto start = std::chrono::steady_clock::now();
+      r->render(world, bc.samples, bc.bounces);
+      if (i >= warmup_frames)
+        ms[i - warmup_frames] = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+    }
+    delete r;
+
+    // counting rays may be slow, so they are counted in a second pass over
+    // the same frames, which trace the same rays as the timed ones
+    std::vector<double> rays(runs);
+    r = create(bc.width, bc.height);
+    r->set_count_rays(true);
+    for (int i = 0; i < warmup_frames + runs; i++) {
+      unsigned long long int before = r->get_ray_count();
+      r->render(world, bc.samples, bc.bounces);
+      if (i >= warmup_frames)
+        rays[i - warmup_frames] = (double)(r->get_ray_count() - before);
+    }
+    delete r;
+
+    double paths = (double)bc.width * bc.height * bc.samples;
+    std::vector<double> mpaths(runs), mrays(runs);
+    for (int i = 0; i < runs; i++) {
+      mpaths[i] = paths / ms[i] / 1e3;
+      mrays[i] = rays[i] / ms[i] / 1e3;
+    }
+    stats frame = get_stats(ms);
+    printf("  %.3f ms/frame, %.1f Mpaths/s, %.1f Mrays/s (medians)\n"
+        , frame.median, get_stats(mpaths).median, get_stats(mrays).median);
+
+    json_cases += format("    {\n      \"scene\": \"%s\", \"width\": %d, "
+        "\"height\": %d, \"samples\": %d, \"bounces\": %d,\n", bc.scene
+        , bc.width, bc.height, bc.samples, bc.bounces)
+      + format("      \"rays_per_frame\": %.0f,\n", get_stats(rays).median)
+      + json_stats("ms_per_frame", frame) + ",\n"
+      + json_stats("mpaths_per_s", get_stats(mpaths)) + ",\n"
+      + json_stats("mrays_per_s", get_stats(mrays)) + "\n"
+      + (c + 1 < cases.size() ? "    },\n" : "    }\n");
+  }
+
+  FILE *f = fopen(filename.c_str(), "w");
+  if (!f)
+    die("cannot write %s", filename.c_str());
+  fprintf(f, "{\n  \"renderer\": %s,\n  \"mode\": %s,\n  \"runs\": %d,\n"
+      "  \"warmup\": %d,\n  \"cases\": [\n%s  ]\n}\n"
+      , json_string(name).c_str(), json_string(mode).c_str(), runs
+      , warmup_frames, json_cases.c_str());
+  fclose(f);
+  printf("wrote %s\n", filename.c_str());
+}
+
+void run_denoise_bench(
+    const std::function<renderer*(int width, int height)> &create, int runs
+    , const std::string &mode, const std::string &filename) {
+  static const char *scenes[] = { "cornell", "spheres:64" };
+  static const int spps[] = { 1, 2, 4, 8 };
+  const int width = 640, height = 480, bounces = 8;
+  const int reference_spp = 1024, reference_samples_per_launch = 16;
+  std::string name, json_cases;
+  for (const char *scene_name : scenes) {
+    printf("%s %dx%d, %d bounces: reference at %d spp\n", scene_name, width
+        , height, bounces, reference_spp);
+    fflush(stdout);
+    scene world;
+    load_scene(scene_name, &world);
+    std::vector<float> reference, image;
+    renderer *r = create(width, height);
+    name = r->get_name();
+    r->set_denoise(false);
+    for (int spp = 0; spp < reference_spp; spp += reference_samples_per_launch)
+      r->render(world, reference_samples_per_launch, bounces);
+    r->read_radiance(&reference);
+    delete r;
+
+    for (int spp : spps)
+      for (bool denoise : { false, true }) {
+        std::vector<double> ms(runs);
+        r = create(width, height);
+        r->set_denoise(denoise);
+        for (int i = 0; i < warmup_frames + runs; i++) {
+          // moving nothing still makes a commit that restarts accumulation
+          world.sphere_changed(0);
+          world.commit();
+          auto start = std::chrono::steady_clock::now();
+          r->render(world, spp, bounces);
+          if (i >= warmup_frames)
+            ms[i - warmup_frames] = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - start).count();
+        }
+        r->read_radiance(&image);
+        delete r;
+        double error = image_rmse(image, reference);
+        stats frame = get_stats(ms);
+        printf("  %d spp%s: %.3f ms/frame (median), rmse %.4f\n", spp
+            , denoise ? ", denoised" : "", frame.median, error);
+        fflush(stdout);
+
+        if (!json_cases.empty())
+          json_cases += ",\n";
+        json_cases += format("    {\n      \"scene\": \"%s\", \"width\": %d, "
+            "\"height\": %d, \"samples\": %d, \"bounces\": %d,\n"
+            , scene_name, width, height, spp, bounces)
+          + format("      \"denoise\": %s, \"rmse\": %.6f,\n"
+              , denoise ? "true" : "false", error)
+          + json_stats("ms_per_frame", frame) + "\n    }";
+      }
+  }
+
+  FILE *f = fopen(filename.c_str(), "w");
+  if (!f)
+    die("cannot write %s", filename.c_str());
+  fprintf(f, "{\n  \"renderer\": %s,\n  \"mode\": %s,\n  \"runs\": %d,\n"
+      "  \"warmup\": %d,\n  \"reference_spp\": %d,\n  \"cases\": [\n%s\n"
+      "  ]\n}\n", json_string(name).c_str(), json_string(mode).c_str(), runs
+      , warmup_frames, reference_spp, json_cases.c_str());
+  fclose(f);
+  printf("wrote %s\n", filename.c_str());
+}
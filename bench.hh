@@ -0,0 +1,22 @@
+#pragma once
+
+#include "renderer.hh"
+#include <functional>
+#include <string>
+
+// renders a fixed set of scenes at several resolutions, sample and bounce
+// counts, `runs` timed frames each, and writes frame times and throughput
+// (min, median and p99 over the frames) to `filename` as JSON. `create`
+// makes a renderer for an image of the given size, `mode` says how it is
+// set up. random sequences start from the same seeds every time, so runs on
+// one device trace the same rays
+void run_bench(const std::function<renderer*(int width, int height)> &create
+    , int runs, const std::string &mode, const std::string &filename);
+// what denoising costs and gains: frames of a few samples per pixel, each
+// restarting accumulation like those of an animation, timed with and without
+// denoising, and the RMSE of their images against a reference of many
+// samples. written to `filename` as JSON like run_bench()
+void run_denoise_bench(
+    const std::function<renderer*(int width, int height)> &create, int runs
+    , const std::string &mode, const std::string &filename);
+
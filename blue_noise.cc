@@ -0,0 +1,95 @@
+#include "blue_noise.hh"
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+// Ulichney's void and cluster: pixels are switched on one at a time where
+// the switched on ones leave the largest void, and their order is the value.
+// voids and clusters are where a gaussian blur of the switched on pixels,
+// wrapped around the tile's edges, is smallest and largest
+static std::vector<float> make_blue_noise(int n) {
+  const int pixels = n * n;
+  const float sigma = 1.5f;
+  // the blur of one pixel by offset from it
+  std::vector<float> blur(pixels);
+  for (int y = 0; y < n; y++)
+    for (int x = 0; x < n; x++) {
+      int dx = std::min(x, n - x), dy = std::min(y, n - y);
+      blur[y * n + x] = std::exp(-(float)(dx * dx + dy * dy)
+          / (2.f * sigma * sigma));
+    }
+
+  std::vector<char> on(pixels, 0);
+  std::vector<float> energy(pixels, 0.f);
+  auto set = [&](int p, bool value) {
+    on[p] = value;
+    float sign = value ? 1.f : -1.f;
+    int px = p % n, py = p / n;
+    for (int y = 0; y < n; y++) {
+      const float *row = &blur[(y - py + n) % n * n];
+      for (int x = 0; x < n; x++)
+        energy[y * n + x] += sign * row[(x - px + n) % n];
+    }
+  };
+  auto tightest_cluster = [&]() {
+    int best = -1;
+    for (int p = 0; p < pixels; p++)
+      if (on[p] && (best < 0 || energy[p] > energy[best]))
+        best = p;
+    return best;
+  };
+  auto largest_void = [&]() {
+    int best = -1;
+    for (int p = 0; p < pixels; p++)
+      if (!on[p] && (best < 0 || energy[p] < energy[best]))
+        best = p;
+    return best;
+  };
+
+  // a tenth of the pixels at random, moved out of clusters into voids until
+  // the one leaving the tightest cluster would go straight back
+  std::mt19937 rng(1);
+  int initial = pixels / 10;
+  for (int placed = 0; placed < initial; ) {
+    int p = (int)(rng() % pixels);
+    if (!on[p]) {
+      set(p, true);
+      ++placed;
+    }
+  }
+  for (;;) {
+    int cluster = tightest_cluster();
+    set(cluster, false);
+    int gap = largest_void();
+    set(gap, true);
+    if (gap == cluster)
+      break;
+  }
+
+  // the initial pixels rank below the rest, the tightest clustered lowest
+  std::vector<int> rank(pixels);
+  std::vector<char> initial_on = on;
+  std::vector<float> initial_energy = energy;
+  for (int r = initial - 1; r >= 0; r--) {
+    int cluster = tightest_cluster();
+    set(cluster, false);
+    rank[cluster] = r;
+  }
+  on = initial_on;
+  energy = initial_energy;
+  for (int r = initial; r < pixels; r++) {
+    int gap = largest_void();
+    set(gap, true);
+    rank[gap] = r;
+  }
+
+  std::vector<float> noise(pixels);
+  for (int p = 0; p < pixels; p++)
+    noise[p] = ((float)rank[p] + 0.5f) / (float)pixels;
+  return noise;
+}
+
+const std::vector<float>& blue_noise() {
+  static const std::vector<float> noise = make_blue_noise(blue_noise_size);
+  return noise;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <vector>
+
+// side of the blue noise tile, which repeats across the image
+static const int blue_noise_size = 64;
+
+// blue_noise_size^2 values in [0, 1), row by row, evenly spread over the
+// range and placed so that similar values are far apart and tile without
+// seams. made on first use by the void and cluster method
+const std::vector<float>& blue_noise();
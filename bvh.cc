@@ -0,0 +1,212 @@
+#include "bvh.hh"
+#include "utils.hh"
+#include <algorithm>
+#include <cfloat>
+
+void aabb::reset() {
+  for (int a = 0; a < 3; a++) {
+    min[a] = FLT_MAX;
+    max[a] = -FLT_MAX;
+  }
+}
+
+void aabb::grow(const aabb &other) {
+  for (int a = 0; a < 3; a++) {
+    min[a] = std::min(min[a], other.min[a]);
+    max[a] = std::max(max[a], other.max[a]);
+  }
+}
+
+void aabb::grow(const float point[3]) {
+  for (int a = 0; a < 3; a++) {
+    min[a] = std::min(min[a], point[a]);
+    max[a] = std::max(max[a], point[a]);
+  }
+}
+
+float aabb::area() const {
+  float d[3];
+  for (int a = 0; a < 3; a++)
+    d[a] = std::max(max[a] - min[a], 0.f);
+  return 2.f * (d[0] * d[1] + d[1] * d[2] + d[2] * d[0]);
+}
+
+bvh::bvh() : _depth(0) {
+}
+
+static const int num_bins = 16, max_leaf_size = 8;
+// relative costs of one traversal step and one primitive intersection
+static const float traversal_cost = 1.f, intersection_cost = 1.f;
+
+static void set_node_bounds(bvh_node *node, const aabb &box) {
+  for (int a = 0; a < 3; a++) {
+    node->bmin[a] = box.min[a];
+    node->bmax[a] = box.max[a];
+  }
+}
+
+int bvh::_build_node(int node, int first, int count, int depth
+    , const std::vector<aabb> &bounds, const std::vector<float> &centroids) {
+  aabb box, centroid_box;
+  box.reset();
+  centroid_box.reset();
+  for (int i = first; i < first + count; i++) {
+    box.grow(bounds[indices[i]]);
+    centroid_box.grow(&centroids[indices[i] * 3]);
+  }
+  set_node_bounds(&nodes[node], box);
+
+  auto make_leaf = [&]() {
+    nodes[node].left_first = first;
+    nodes[node].count = count;
+    for (int i = first; i < first + count; i++)
+      _leaf_of_prim[indices[i]] = node;
+    return depth;
+  };
+
+  if (count == 1 || depth == max_depth)
+    return make_leaf();
+
+  // find the cheapest split among bin boundaries on all axes
+  int best_axis = -1, best_split = 0;
+  float best_cost = FLT_MAX;
+  for (int a = 0; a < 3; a++) {
+    float extent = centroid_box.max[a] - centroid_box.min[a];
+    if (extent <= 0.f)
+      continue;
+    float scale = num_bins / extent;
+    aabb bin_boxes[num_bins];
+    int bin_counts[num_bins] = { 0 };
+    for (int b = 0; b < num_bins; b++)
+      bin_boxes[b].reset();
+    for (int i = first; i < first + count; i++) {
+      int prim = indices[i];
+      int b = std::min(num_bins - 1
+          , (int)((centroids[prim * 3 + a] - centroid_box.min[a]) * scale));
+      bin_boxes[b].grow(bounds[prim]);
+      ++bin_counts[b];
+    }
+    // sweep from the right to get areas and counts of all right halves
+    float right_areas[num_bins];
+    int right_counts[num_bins];
+    aabb acc;
+    acc.reset();
+    int acc_count = 0;
+    for (int b = num_bins - 1; b > 0; b--) {
+      acc.grow(bin_boxes[b]);
+      acc_count += bin_counts[b];
+      right_areas[b] = acc.area();
+      right_counts[b] = acc_count;
+    }
+    acc.reset();
+    acc_count = 0;
+    for (int b = 0; b < num_bins - 1; b++) {
+      acc.grow(bin_boxes[b]);
+      acc_count += bin_counts[b];
+      if (acc_count == 0 || right_counts[b + 1] == 0)
+        continue;
+      float cost = acc.area() * acc_count
+        + right_areas[b + 1] * right_counts[b + 1];
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_axis = a;
+        best_split = b + 1;
+      }
+    }
+  }
+
+  float leaf_cost = intersection_cost * count
+    , split_cost = traversal_cost
+    + intersection_cost * best_cost / std::max(box.area(), FLT_MIN);
+
+  int middle;
+  if (best_axis != -1 && (split_cost < leaf_cost || count > max_leaf_size)) {
+    float scale = num_bins / (centroid_box.max[best_axis]
+        - centroid_box.min[best_axis]);
+    int *split = std::partition(&indices[first], &indices[first] + count
+        , [&](int prim) {
+          int b = std::min(num_bins - 1, (int)((centroids[prim * 3 + best_axis]
+                  - centroid_box.min[best_axis]) * scale));
+          return b < best_split;
+        });
+    middle = (int)(split - &indices[0]);
+  } else if (count > max_leaf_size) {
+    // all centroids coincide: any split is as good as another
+    middle = first + count / 2;
+  } else
+    return make_leaf();
+
+  int left = (int)nodes.size();
+  nodes.resize(nodes.size() + 2);
+  _parents.resize(nodes.size());
+  _parents[left] = _parents[left + 1] = node;
+  nodes[node].left_first = left;
+  nodes[node].count = 0;
+  int left_depth = _build_node(left, first, middle - first, depth + 1
+      , bounds, centroids);
+  int right_depth = _build_node(left + 1, middle, first + count - middle
+      , depth + 1, bounds, centroids);
+  return std::max(left_depth, right_depth);
+}
+
+void bvh::build(const std::vector<aabb> &bounds) {
+  int num_prims = (int)bounds.size();
+  // an empty bvh has no nodes at all, not even a root
+  if (num_prims == 0) {
+    nodes.clear();
+    indices.clear();
+    _parents.clear();
+    _leaf_of_prim.clear();
+    _depth = 0;
+    return;
+  }
+  std::vector<float> centroids(num_prims * 3);
+  for (int i = 0; i < num_prims; i++)
+    for (int a = 0; a < 3; a++)
+      centroids[i * 3 + a] = 0.5f * (bounds[i].min[a] + bounds[i].max[a]);
+
+  indices.resize(num_prims);
+  for (int i = 0; i < num_prims; i++)
+    indices[i] = i;
+  _leaf_of_prim.assign(num_prims, 0);
+  nodes.clear();
+  nodes.reserve(2 * num_prims);
+  nodes.resize(1);
+  _parents.assign(1, -1);
+  _depth = _build_node(0, 0, num_prims, 0, bounds, centroids);
+}
+
+void bvh::_fit_node(int node, const std::vector<aabb> &bounds) {
+  aabb box;
+  box.reset();
+  const bvh_node &n = nodes[node];
+  if (n.count > 0)
+    for (int i = n.left_first; i < n.left_first + n.count; i++)
+      box.grow(bounds[indices[i]]);
+  else
+    for (int child = n.left_first; child <= n.left_first + 1; child++) {
+      const bvh_node &c = nodes[child];
+      aabb child_box;
+      for (int a = 0; a < 3; a++) {
+        child_box.min[a] = c.bmin[a];
+        child_box.max[a] = c.bmax[a];
+      }
+      box.grow(child_box);
+    }
+  set_node_bounds(&nodes[node], box);
+}
+
+void bvh::refit(const std::vector<aabb> &bounds
+    , const std::vector<int> &changed_prims, std::vector<int> *refitted) {
+  for (int prim : changed_prims)
+    for (int node = _leaf_of_prim[prim]; node != -1; node = _parents[node]) {
+      _fit_node(node, bounds);
+      if (refitted)
+        refitted->push_back(node);
+    }
+}
+
+int bvh::get_depth() const {
+  return _depth;
+}
+
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <CL/cl.hpp>
+#include <vector>
+
+struct aabb {
+  float min[3], max[3];
+  void reset();
+  void grow(const aabb &other);
+  void grow(const float point[3]);
+  float area() const;
+};
+
+// laid out so that the kernel can fetch a node as two float4s
+struct bvh_node {
+  cl_float bmin[3];
+  cl_int left_first; // left child (right one follows it), first index of leaf
+  cl_float bmax[3];
+  cl_int count; // number of primitives in a leaf, 0 for inner nodes
+};
+
+// bounding volume hierarchy over any primitives given by their bounds, built
+// with binned SAH. nodes come before their children, so node 0 is the root
+class bvh {
+  std::vector<int> _parents, _leaf_of_prim;
+  int _depth;
+
+  int _build_node(int node, int first, int count, int depth
+      , const std::vector<aabb> &bounds, const std::vector<float> &centroids);
+  void _fit_node(int node, const std::vector<aabb> &bounds);
+public:
+  // the kernel's traversal stack has this many entries
+  static const int max_depth = 64;
+
+  std::vector<bvh_node> nodes;
+  std::vector<cl_int> indices; // primitive indices referenced by leaves
+
+  bvh();
+  void build(const std::vector<aabb> &bounds);
+  // updates the bounds of the nodes above the given primitives after they
+  // have moved. the tree itself stays as built. the nodes updated are added
+  // to `refitted` if given, possibly more than once
+  void refit(const std::vector<aabb> &bounds
+      , const std::vector<int> &changed_prims
+      , std::vector<int> *refitted = nullptr);
+  int get_depth() const;
+};
+
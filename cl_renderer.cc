@@ -0,0 +1,1147 @@
+#include "cl_renderer.hh"
+#include "blue_noise.hh"
+#include "ocl.hh"
+#include "utils.hh"
+#include <GL/glx.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+// specialised builds kept around for switching back and forth
+static const size_t max_variants = 8;
+
+// mirrors Path in opencl_kernel.cl
+struct wavefront_path {
+  cl_float3 origin;
+  cl_float3 dir;
+  cl_float3 mask;
+  cl_float3 radiance;
+  cl_float t;
+  cl_int hit_id;
+  cl_float pdf;
+  cl_uint sampler[4];
+};
+
+cl_renderer::cl_renderer(const cl::Platform &platform, const cl::Device &device
+    , int width, int height, const std::vector<GLuint> &gl_texs
+    , bool gl_sharing)
+  : _device(device)
+  , _pixel_buffers(!gl_texs.empty() && !gl_sharing)
+  , _persistent_map(false)
+  , _zero_copy_out(false)
+  , _specialise(false)
+  , _specialise_wait(false)
+  , _local_sphere_bytes(0)
+  , _gl_current(0)
+  , _upload_slot(-1)
+  , _create_event_from_gl_sync(nullptr)
+  , _denoise(false)
+  , _aov_begin(0)
+  , _aov_end(0)
+  , _temporal(false)
+  , _previous_spheres_capacity(0)
+  , _history_begin(0)
+  , _history_end(0)
+  , _sequence(0)
+  , _width(width)
+  , _height(height)
+  , _view({{ 0, 0, width, height }})
+  , _last_scene(nullptr)
+  , _last_version(0)
+  , _last_mesh_version(0)
+  , _last_bounces(-1)
+  , _frame(0)
+  , _samples(0)
+  , _pending_samples(0)
+  , _kernel_pending(false)
+  , _wavefront(false)
+  , _nee(true)
+  , _count_rays(false)
+  , _sampler(sampler_type::blue_noise)
+  , _rays(0)
+  , _profiler(nullptr)
+  , _adaptive_threshold(0.f)
+  , _tiles_x((width + tile_size - 1) / tile_size)
+  , _tiles_y((height + tile_size - 1) / tile_size)
+  , _vertices_capacity(0)
+  , _triangles_capacity(0)
+  , _materials_capacity(0)
+  , _triangle_nodes_capacity(0)
+  , _triangle_indices_capacity(0) {
+  if (!gl_texs.empty() && gl_sharing) {
+    cl_context_properties properties[] = {
+      CL_GL_CONTEXT_KHR, (cl_context_properties)glXGetCurrentContext(),
+      CL_GLX_DISPLAY_KHR, (cl_context_properties)glXGetCurrentDisplay(),
+      CL_CONTEXT_PLATFORM, (cl_context_properties)platform(),
+      0
+    };
+    _context = cl::Context(_device, properties);
+  } else {
+    cl_context_properties properties[] = {
+      CL_CONTEXT_PLATFORM, (cl_context_properties)platform(),
+      0
+    };
+    _context = cl::Context(_device, properties);
+  }
+
+  // profiling gives the kernel times that multi-device rendering balances by
+  // and the command timings of set_profiler()
+  _queue = cl::CommandQueue(_context, _device, CL_QUEUE_PROFILING_ENABLE);
+  if (_pixel_buffers)
+    _read_queue = cl::CommandQueue(_context, _device
+        , CL_QUEUE_PROFILING_ENABLE);
+
+  // math options such as -cl-fast-relaxed-math come from
+  // ocl_set_build_options()
+  _build_options = "-D TILE_SIZE=" + std::to_string(tile_size)
+    + " -D BLUE_NOISE_SIZE=" + std::to_string(blue_noise_size);
+  if (gl_texs.empty())
+    _build_options += " -D OUTPUT_BUFFER";
+  else if (_pixel_buffers)
+    _build_options += " -D OUTPUT_HALF";
+  _build_program();
+  _ray_count = cl::Buffer(_context, CL_MEM_READ_WRITE, sizeof(cl_uint));
+  const std::vector<float> &noise = blue_noise();
+  _blue_noise = cl::Buffer(_context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR
+      , noise.size() * sizeof(float), (void*)noise.data());
+
+  // a CPU device can read the host's copy in place
+  bool zero_copy = _device.getInfo<CL_DEVICE_TYPE>() == CL_DEVICE_TYPE_CPU;
+  for (scene_buffer *buffer : { &_sphere_geometry, &_sphere_materials
+      , &_sphere_nodes, &_sphere_indices, &_lights })
+    buffer->init(_context, _queue, zero_copy);
+  // spheres are staged in local memory where it is on chip, in at most a
+  // quarter of it so that several work groups still fit on a compute unit.
+  // emulated in global memory, as on CPUs, it would only add a copy
+  _local_sphere_bytes = _device.getInfo<CL_DEVICE_LOCAL_MEM_TYPE>() == CL_LOCAL
+    ? _device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>() / 4 : 0;
+
+  _accum = cl::Buffer(_context, CL_MEM_READ_WRITE
+      , (size_t)_width * _height * sizeof(cl_float4));
+  _moments = cl::Buffer(_context, CL_MEM_READ_WRITE
+      , (size_t)_width * _height * sizeof(cl_float));
+  size_t tiles = (size_t)_tiles_x * _tiles_y;
+  _tiles = cl::Buffer(_context, CL_MEM_READ_ONLY, tiles * sizeof(cl_int));
+  _tile_error = cl::Buffer(_context, CL_MEM_WRITE_ONLY
+      , tiles * sizeof(cl_float));
+  _tile_errors.resize(tiles);
+
+  for (GLuint gl_tex : gl_texs) {
+    if (_pixel_buffers)
+      break;
+    // create opencl texture reference using opengl texture
+    cl_int err_code;
+    cl::ImageGL tex = cl::ImageGL(_context, CL_MEM_WRITE_ONLY, GL_TEXTURE_2D
+        , 0, gl_tex, &err_code);
+    assertf(err_code == CL_SUCCESS, "Failed to create OpenGL texture refrence "
+        "(%d)", err_code);
+    _gl_objs.push_back(tex);
+  }
+  if (gl_texs.empty())
+    _out = cl::Buffer(_context, CL_MEM_WRITE_ONLY
+        , (size_t)_width * _height * sizeof(cl_uchar4));
+  // without cl_khr_gl_event the host waits for GL fences itself
+  if (gl_texs.size() > 1 && gl_sharing && ocl_device_has_extension(_device
+        , "cl_khr_gl_event"))
+    _create_event_from_gl_sync = (cl_event (CL_API_CALL *)(cl_context
+          , cl_GLsync, cl_int*))clGetExtensionFunctionAddressForPlatform(
+          platform(), "clCreateEventFromGLsyncKHR");
+  _slots.resize(std::max<size_t>(gl_texs.size(), 1));
+
+  if (!_pixel_buffers)
+    return;
+  // half floats, as the kernel writes them with OUTPUT_HALF
+  size_t size = (size_t)_width * _height * 4 * sizeof(cl_half);
+  _persistent_map = GLEW_ARB_buffer_storage;
+  // integrated GPUs as well as CPUs can render into the mapping in place
+  _zero_copy_out = _persistent_map
+    && _device.getInfo<CL_DEVICE_HOST_UNIFIED_MEMORY>();
+  GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT
+    | GL_MAP_COHERENT_BIT;
+  for (size_t i = 0; i < gl_texs.size(); i++) {
+    frame_slot &s = _slots[i];
+    s.texture = gl_texs[i];
+    glGenBuffers(1, &s.pixel_buffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s.pixel_buffer);
+    if (_persistent_map) {
+      glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, nullptr, flags);
+      s.pixels = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags);
+      assertf(s.pixels, "failed to map pixel buffer");
+    } else
+      glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+    if (_zero_copy_out)
+      s.out = cl::Buffer(_context, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR
+          , size, s.pixels);
+    else
+      s.out = cl::Buffer(_context, CL_MEM_WRITE_ONLY, size);
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+cl_renderer::~cl_renderer() {
+  // pending reads and uploads still use host memory
+  if (_pixel_buffers) {
+    _read_queue.finish();
+    for (frame_slot &slot : _slots)
+      if (_zero_copy_out && slot.read())
+        _queue.enqueueUnmapMemObject(slot.out, slot.pixels);
+  }
+  _queue.finish();
+  for (frame_slot &slot : _slots) {
+    if (slot.presented)
+      glDeleteSync(slot.presented);
+    if (slot.uploaded)
+      glDeleteSync(slot.uploaded);
+    // the device's buffer goes before the memory it may use, deleting the
+    // pixel buffer unmaps it
+    slot.out = cl::Buffer();
+    if (slot.pixel_buffer)
+      glDeleteBuffers(1, &slot.pixel_buffer);
+  }
+}
+
+std::string cl_renderer::_program_options() {
+  // sampler_type has the values of SAMPLER_* in the kernel
+  return _build_options + (_count_rays ? " -D COUNT_RAYS" : "")
+    + " -D SAMPLER=" + std::to_string(static_cast<int>(_sampler));
+}
+
+// (re)builds the program and its kernels with the current options
+void cl_renderer::_build_program() {
+  _source = read_file_to_string("opencl_kernel.cl");
+  _program = ocl_build_program(_context, _device, _source
+      , _program_options());
+  // specialised builds have the old options
+  if (_pending_variant.valid())
+    _pending_variant.wait();
+  _pending_variant = std::future<variant>();
+  _variants.clear();
+
+  _kernel = cl::Kernel(_program, "render_kernel");
+  _local_work_size = _kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(
+      _device);
+
+  _generate_kernel = cl::Kernel(_program, "generate_kernel");
+  _extend_kernel = cl::Kernel(_program, "extend_kernel");
+  _shade_kernel = cl::Kernel(_program, "shade_kernel");
+  _accumulate_kernel = cl::Kernel(_program, "accumulate_kernel");
+  _tile_error_kernel = cl::Kernel(_program, "tile_error_kernel");
+  _wavefront_local_size = _local_work_size;
+  for (const cl::Kernel *kernel : { &_generate_kernel, &_extend_kernel
+      , &_shade_kernel, &_accumulate_kernel })
+    _wavefront_local_size = std::min(_wavefront_local_size
+        , kernel->getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(_device));
+
+  _aov_kernel = cl::Kernel(_program, "aov_kernel");
+  _denoise_input_kernel = cl::Kernel(_program, "denoise_input_kernel");
+  _atrous_kernel = cl::Kernel(_program, "atrous_kernel");
+  _denoise_local_size = _local_work_size;
+  for (const cl::Kernel *kernel : { &_aov_kernel, &_denoise_input_kernel
+      , &_atrous_kernel })
+    _denoise_local_size = std::min(_denoise_local_size
+        , kernel->getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(_device));
+  _reproject_kernel = cl::Kernel(_program, "reproject_kernel");
+  _reproject_local_size = std::min(_local_work_size
+      , _reproject_kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(
+        _device));
+}
+
+// render_kernel for these parameters: a build specialised for them when
+// there is one, the generic one otherwise. unless waiting for them,
+// specialised builds happen in the background while the generic kernel
+// keeps rendering
+cl::Kernel& cl_renderer::_select_render_kernel(int samples, int bounces
+    , size_t *local_size) {
+  *local_size = _local_work_size;
+  if (!_specialise)
+    return _kernel;
+  std::string build_options = _program_options()
+    + " -D SPEC_BOUNCES=" + std::to_string(bounces)
+    + " -D SPEC_WIDTH=" + std::to_string(_width)
+    + " -D SPEC_HEIGHT=" + std::to_string(_height)
+    + " -D SPEC_VIEW_WIDTH=" + std::to_string(_view.s[2])
+    + " -D SPEC_VIEW_HEIGHT=" + std::to_string(_view.s[3]);
+  // adaptive sampling changes the samples of every launch, they stay an
+  // argument then
+  if (_adaptive_threshold <= 0.f)
+    build_options += " -D SPEC_SAMPLES=" + std::to_string(samples);
+
+  auto take_finished_build = [this]() {
+    _variants.push_front(_pending_variant.get());
+    if (_variants.size() > max_variants)
+      _variants.pop_back();
+  };
+  // moves the build for these options to the front and returns its kernel,
+  // nullptr if there is none. failed builds stay in the list without a
+  // kernel so that they are not tried again, the generic one stands in
+  auto find_build = [&]() -> cl::Kernel* {
+    for (auto it = _variants.begin(); it != _variants.end(); ++it)
+      if (it->build_options == build_options) {
+        _variants.splice(_variants.begin(), _variants, it);
+        if (!it->kernel())
+          return &_kernel;
+        *local_size = it->local_size;
+        return &it->kernel;
+      }
+    return nullptr;
+  };
+  if (_pending_variant.valid() && _pending_variant.wait_for(
+        std::chrono::seconds(0)) == std::future_status::ready)
+    take_finished_build();
+  if (cl::Kernel *kernel = find_build())
+    return *kernel;
+  // one build at a time, the next one starts once it is done
+  if (_pending_variant.valid() && !_specialise_wait)
+    return _kernel;
+  // the build waited for may be the one wanted
+  if (_pending_variant.valid()) {
+    take_finished_build();
+    if (cl::Kernel *kernel = find_build())
+      return *kernel;
+  }
+
+  // a failed build is handed back rather than exiting from the worker
+  // thread while this one renders
+  cl::Context context = _context;
+  cl::Device device = _device;
+  std::string source = _source;
+  _pending_variant = std::async(std::launch::async, [=]() {
+        variant v;
+        v.build_options = build_options;
+        v.local_size = 0;
+        bool failed;
+        v.program = ocl_build_program(context, device, source
+            , build_options, &failed);
+        if (failed)
+          return v;
+        v.kernel = cl::Kernel(v.program, "render_kernel");
+        v.local_size = v.kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(
+            device);
+        return v;
+      });
+  if (!_specialise_wait)
+    return _kernel;
+  take_finished_build();
+  return *find_build();
+}
+
+bool cl_renderer::accum_invalidated(const scene &world, int bounces) {
+  return _last_scene != &world || _last_version != world.version
+    || memcmp(&_last_cam_position, &world.cam_position
+        , sizeof(world.cam_position)) != 0
+    || _last_bounces != bounces
+    || memcmp(&_last_view, &_view, sizeof(_view)) != 0;
+}
+
+cl::Event* cl_renderer::_profile(const char *stage) {
+  return _profiler ? _profiler->command(_profile_track, stage) : nullptr;
+}
+
+std::function<void(const cl::Event&)> cl_renderer::_profile_events(
+    const char *stage) {
+  return [this, stage](const cl::Event &event) {
+    if (_profiler)
+      _profiler->command(_profile_track, stage, event);
+  };
+}
+
+void cl_renderer::render(const scene &world, int samples, int bounces) {
+  {
+    profile_scope scope(_profiler, "enqueue");
+    enqueue(world, samples, bounces, 0, _height);
+  }
+  profile_scope scope(_profiler, "finish");
+  finish();
+}
+
+// (re)allocates `buffer` if it cannot hold `data` and queues the upload.
+// empty data still gets a buffer since kernel arguments cannot be null
+template <typename T>
+static void upload(const cl::Context &context, const cl::CommandQueue &queue
+    , cl::Buffer *buffer, size_t *capacity, const std::vector<T> &data
+    , cl::Event *event) {
+  size_t size = data.size() * sizeof(T);
+  if (size > *capacity || *capacity == 0) {
+    *capacity = std::max(size, sizeof(T));
+    *buffer = cl::Buffer(context, CL_MEM_READ_ONLY, *capacity);
+  }
+  if (size)
+    queue.enqueueWriteBuffer(*buffer, CL_FALSE, 0, size, data.data(), nullptr
+        , event);
+}
+
+// only what commits changed since the last upload is sent, as long as the
+// scene keeps track of that
+bool cl_renderer::_upload_spheres(const scene &world) {
+  bool partial = _last_scene == &world && world.get_changes(_last_version
+      , &_changed_spheres, &_changed_sphere_nodes);
+  std::vector<scene_buffer::range> spheres, nodes;
+  if (partial) {
+    spheres = scene_buffer::ranges(_changed_spheres, sizeof(cl_float4));
+    nodes = scene_buffer::ranges(_changed_sphere_nodes, sizeof(bvh_node));
+  }
+  // temporal reuse follows moved spheres back to where they were
+  if (partial && _temporal) {
+    size_t size = world.sphere_geometry.size() * sizeof(cl_float4);
+    if (size > _previous_spheres_capacity || _previous_spheres_capacity == 0) {
+      _previous_spheres_capacity = std::max(size, sizeof(cl_float4));
+      _previous_spheres = cl::Buffer(_context, CL_MEM_READ_WRITE
+          , _previous_spheres_capacity);
+    }
+    if (size)
+      _queue.enqueueCopyBuffer(_sphere_geometry.get(), _previous_spheres, 0
+          , 0, size, nullptr, _profile("upload spheres"));
+  }
+  _sphere_geometry.upload(world.sphere_geometry.data()
+      , world.sphere_geometry.size() * sizeof(cl_float4)
+      , partial ? &spheres : nullptr, _profile_events("upload spheres"));
+  _sphere_nodes.upload(world.sphere_bvh.nodes.data()
+      , world.sphere_bvh.nodes.size() * sizeof(bvh_node)
+      , partial ? &nodes : nullptr, _profile_events("upload sphere bvh"));
+  // refitting changes neither the order of the spheres nor which shine, and
+  // commits only move spheres
+  if (partial)
+    return true;
+  _sphere_materials.upload(world.sphere_materials.data()
+      , world.sphere_materials.size() * sizeof(Material), nullptr
+      , _profile_events("upload spheres"));
+  _sphere_indices.upload(world.sphere_bvh.indices.data()
+      , world.sphere_bvh.indices.size() * sizeof(cl_int), nullptr
+      , _profile_events("upload sphere bvh"));
+  _lights.upload(world.lights.data(), world.lights.size() * sizeof(cl_int)
+      , nullptr, _profile_events("upload lights"));
+  return false;
+}
+
+void cl_renderer::enqueue(const scene &world, int samples, int bounces
+    , int y_begin, int y_end) {
+  bool reset = accum_invalidated(world, bounces);
+  // with temporal reuse, pixels can take over the samples of the launch
+  // before if spheres or the camera are all that moved
+  bool history = false, spheres_moved = false;
+  cl_float3 previous_cam_position = _last_cam_position;
+  if (reset) {
+    history = _temporal && _last_scene == &world
+      && _last_mesh_version == world.mesh_version && _last_bounces == bounces
+      && memcmp(&_last_view, &_view, sizeof(_view)) == 0;
+    // the scene only needs uploading when it has changed
+    if (_last_scene != &world || _last_version != world.version) {
+      spheres_moved = true;
+      history = _upload_spheres(world) && history;
+    }
+    // meshes are static and possibly huge, they are only sent once
+    if (_last_scene != &world || _last_mesh_version != world.mesh_version) {
+      upload(_context, _queue, &_vertices, &_vertices_capacity
+          , world.vertices, _profile("upload mesh"));
+      upload(_context, _queue, &_triangles, &_triangles_capacity
+          , world.triangles, _profile("upload mesh"));
+      upload(_context, _queue, &_materials, &_materials_capacity
+          , world.materials, _profile("upload mesh"));
+      upload(_context, _queue, &_triangle_nodes, &_triangle_nodes_capacity
+          , world.triangle_bvh.nodes, _profile("upload mesh"));
+      upload(_context, _queue, &_triangle_indices, &_triangle_indices_capacity
+          , world.triangle_bvh.indices, _profile("upload mesh"));
+    }
+    _last_scene = &world;
+    _last_version = world.version;
+    _last_mesh_version = world.mesh_version;
+    _last_cam_position = world.cam_position;
+    _last_bounces = bounces;
+    _last_view = _view;
+    _samples = 0;
+  }
+  _pending_samples = samples;
+
+  if (y_begin >= y_end) {
+    _history_begin = _history_end = 0;
+    _kernel_pending = false;
+    return;
+  }
+
+  cl_int4 region = {{ 0, y_begin, _width, y_end }};
+  // the launch adds to what was reprojected instead of starting over
+  bool clear = reset;
+  cl::Event reproject_event;
+  if (reset && _temporal) {
+    _enqueue_reproject(world, region, history, spheres_moved
+        , previous_cam_position, &reproject_event);
+    clear = false;
+  } else {
+    // rows new to this renderer have nothing to check history against
+    _history_begin = std::max(_history_begin, y_begin);
+    _history_end = std::min(_history_end, y_end);
+  }
+  // past the first samples, adaptive sampling only renders the tiles that
+  // still are noisy, giving them the samples the others would have had
+  int tile_samples = samples;
+  cl_int num_tiles = 0;
+  // one work item per pixel of the tiles the rows touch, see launch_pixel()
+  // in the kernel
+  size_t items = (size_t)_tiles_x * ((y_end + tile_size - 1) / tile_size
+      - y_begin / tile_size) * tile_size * tile_size;
+  if (_adaptive_threshold > 0.f && !reset && _samples >= adaptive_warmup_spp
+      && samples > 0) {
+    num_tiles = _select_tiles(region, samples, &tile_samples);
+    if (num_tiles == 0) {
+      // converged, nothing left to do
+      _pending_samples = 0;
+      _kernel_pending = false;
+      return;
+    }
+    items = (size_t)num_tiles * tile_size * tile_size;
+  }
+
+  std::vector<cl::Memory> texture;
+  if (!_gl_objs.empty()) {
+    texture.push_back(_gl_objs[_gl_current]);
+    std::vector<cl::Event> wait = _wait_for_texture(_gl_current);
+    _queue.enqueueAcquireGLObjects(&texture, wait.empty() ? nullptr : &wait
+        , _profile("acquire"));
+  } else if (_pixel_buffers)
+    _map_pixel_buffer(_gl_current);
+
+  if (_wavefront)
+    _enqueue_wavefront(world, tile_samples, bounces, clear, region, num_tiles
+        , items);
+  else {
+    size_t local_size;
+    cl::Kernel &kernel = _select_render_kernel(tile_samples, bounces
+        , &local_size);
+    kernel.setArg(0, tile_samples);
+    kernel.setArg(1, bounces);
+    int arg = _set_scene_args(&kernel, 2, world);
+    arg = _set_output_args(&kernel, arg);
+    kernel.setArg(arg++, _frame);
+    kernel.setArg(arg++, _sequence);
+    kernel.setArg(arg++, (cl_int)clear);
+    kernel.setArg(arg++, world.cam_position);
+    kernel.setArg(arg++, _view);
+    kernel.setArg(arg++, region);
+    kernel.setArg(arg++, _tiles);
+    kernel.setArg(arg++, num_tiles);
+    _enqueue_1d(kernel, "render", items, local_size, &_kernel_event);
+    _first_event = _kernel_event;
+  }
+  if (reproject_event())
+    _first_event = reproject_event;
+  if (_denoise)
+    _enqueue_denoise(world, reset, region);
+  _kernel_pending = true;
+
+  if (!_gl_objs.empty())
+    _queue.enqueueReleaseGLObjects(&texture, nullptr, _profile("release"));
+  _queue.flush();
+  if (_pixel_buffers)
+    _enqueue_pixel_read(_gl_current);
+}
+
+// finds the tiles overlapping `region` whose error is above the threshold and
+// spreads the samples of the whole region over them. returns their number
+int cl_renderer::_select_tiles(const cl_int4 &region, int samples
+    , int *tile_samples) {
+  _tile_error_kernel.setArg(0, _accum);
+  _tile_error_kernel.setArg(1, _moments);
+  _tile_error_kernel.setArg(2, _width);
+  _tile_error_kernel.setArg(3, _height);
+  _tile_error_kernel.setArg(4, region);
+  _tile_error_kernel.setArg(5, _tile_error);
+  _enqueue_1d(_tile_error_kernel, "tile error", _tile_errors.size()
+      , _local_work_size, nullptr);
+  _queue.enqueueReadBuffer(_tile_error, CL_TRUE, 0
+      , _tile_errors.size() * sizeof(cl_float), _tile_errors.data(), nullptr
+      , _profile("read tile errors"));
+
+  _tile_list.clear();
+  int region_tiles = 0;
+  for (int ty = region.s[1] / tile_size
+      ; ty < (region.s[3] + tile_size - 1) / tile_size; ty++)
+    for (int tx = 0; tx < _tiles_x; tx++, region_tiles++)
+      if (_tile_errors[ty * _tiles_x + tx] > _adaptive_threshold)
+        _tile_list.push_back(ty * _tiles_x + tx);
+  int active = (int)_tile_list.size();
+  if (active == 0)
+    return 0;
+
+  *tile_samples = std::min(samples * region_tiles / active
+      , samples * adaptive_max_boost);
+  // what was spent, in samples per pixel of the whole region
+  _pending_samples = std::max(1, *tile_samples * active / region_tiles);
+  // _tile_list stays untouched until finish()
+  _queue.enqueueWriteBuffer(_tiles, CL_FALSE, 0, active * sizeof(cl_int)
+      , _tile_list.data(), nullptr, _profile("upload tiles"));
+  return active;
+}
+
+// these return the index of the argument after them
+int cl_renderer::_set_scene_args(cl::Kernel *kernel, int first
+    , const scene &world) {
+  size_t spheres = world.sphere_geometry.size();
+  bool local = spheres * sizeof(cl_float4) <= _local_sphere_bytes;
+  kernel->setArg(first, _sphere_geometry.get());
+  kernel->setArg(first + 1, _sphere_materials.get());
+  kernel->setArg(first + 2, (cl_int)spheres);
+  // local arguments cannot be empty
+  kernel->setArg(first + 3, cl::Local(std::max<size_t>(local ? spheres : 0, 1)
+        * sizeof(cl_float4)));
+  kernel->setArg(first + 4, local ? (cl_int)spheres : 0);
+  kernel->setArg(first + 5, _sphere_nodes.get());
+  kernel->setArg(first + 6, _sphere_indices.get());
+  kernel->setArg(first + 7, _vertices);
+  kernel->setArg(first + 8, _triangles);
+  kernel->setArg(first + 9, _materials);
+  kernel->setArg(first + 10, (cl_int)world.triangles.size());
+  kernel->setArg(first + 11, _triangle_nodes);
+  kernel->setArg(first + 12, _triangle_indices);
+  kernel->setArg(first + 13, _lights.get());
+  kernel->setArg(first + 14, _nee ? (cl_int)world.lights.size() : 0);
+  kernel->setArg(first + 15, _ray_count);
+  kernel->setArg(first + 16, _blue_noise);
+  return first + 17;
+}
+
+// what kernels write the image into
+cl::Memory cl_renderer::_output() {
+  if (!_gl_objs.empty())
+    return _gl_objs[_gl_current];
+  return _pixel_buffers ? _slots[_gl_current].out : _out;
+}
+
+int cl_renderer::_set_output_args(cl::Kernel *kernel, int first) {
+  kernel->setArg(first, _output());
+  kernel->setArg(first + 1, _width);
+  kernel->setArg(first + 2, _height);
+  kernel->setArg(first + 3, _accum);
+  kernel->setArg(first + 4, _moments);
+  return first + 5;
+}
+
+// launches one work item per element, padded to whole work groups. `event`
+// may be kept by the caller, the launch is profiled as `stage` either way
+void cl_renderer::_enqueue_1d(const cl::Kernel &kernel, const char *stage
+    , size_t size, size_t local_size, cl::Event *event) {
+  size_t global_work_size = size;
+  if (global_work_size % local_size != 0)
+    global_work_size = (global_work_size / local_size + 1) * local_size;
+  _queue.enqueueNDRangeKernel(kernel, cl::NullRange, global_work_size
+      , local_size, nullptr, event ? event : _profile(stage));
+  if (event && _profiler)
+    _profiler->command(_profile_track, stage, *event);
+}
+
+void cl_renderer::_enqueue_wavefront(const scene &world, int samples
+    , int bounces, bool reset, const cl_int4 &region, cl_int num_tiles
+    , size_t wave) {
+  if (!_paths()) {
+    // enough for every tile, including those sticking out of the image
+    size_t slots = (size_t)_tiles_x * _tiles_y * tile_size * tile_size;
+    _paths = cl::Buffer(_context, CL_MEM_READ_WRITE
+        , slots * sizeof(wavefront_path));
+    for (cl::Buffer &queue : _path_queues)
+      queue = cl::Buffer(_context, CL_MEM_READ_WRITE, slots * sizeof(cl_int));
+    _counters = cl::Buffer(_context, CL_MEM_READ_WRITE, 2 * sizeof(cl_int));
+    _sample_sum = cl::Buffer(_context, CL_MEM_READ_WRITE
+        , slots * sizeof(cl_float4));
+  }
+
+  _generate_kernel.setArg(0, _paths);
+  _generate_kernel.setArg(1, _path_queues[0]);
+  _generate_kernel.setArg(2, _counters);
+  _generate_kernel.setArg(3, _sample_sum);
+  _generate_kernel.setArg(4, _width);
+  _generate_kernel.setArg(5, _height);
+  _generate_kernel.setArg(6, world.cam_position);
+  _generate_kernel.setArg(7, _view);
+  _generate_kernel.setArg(8, _frame);
+  _generate_kernel.setArg(9, _sequence);
+  _generate_kernel.setArg(11, region);
+  _generate_kernel.setArg(12, _tiles);
+  _generate_kernel.setArg(13, num_tiles);
+  _generate_kernel.setArg(14, _accum);
+  _generate_kernel.setArg(15, (cl_int)reset);
+  _generate_kernel.setArg(16, _blue_noise);
+  // queue arguments that change with every bounce follow the scene
+  int extend_arg = _set_scene_args(&_extend_kernel, 0, world);
+  _extend_kernel.setArg(extend_arg, _paths);
+  _extend_kernel.setArg(extend_arg + 2, _counters);
+  int shade_arg = _set_scene_args(&_shade_kernel, 0, world);
+  _shade_kernel.setArg(shade_arg, _paths);
+  _shade_kernel.setArg(shade_arg + 3, _counters);
+  _shade_kernel.setArg(shade_arg + 6, _sample_sum);
+
+  // kernel arguments are captured when a launch is enqueued, so the same
+  // kernel objects can be reused for every bounce
+  for (int sample = 0; sample < samples; sample++) {
+    _queue.enqueueFillBuffer(_counters, (cl_int)0, 0, sizeof(cl_int)
+        , nullptr, sample == 0 ? &_first_event : _profile("clear counters"));
+    if (sample == 0 && _profiler)
+      _profiler->command(_profile_track, "clear counters", _first_event);
+    _generate_kernel.setArg(10, sample);
+    _enqueue_1d(_generate_kernel, "generate", wave, _wavefront_local_size
+        , nullptr);
+    for (int bounce = 0; bounce < bounces; bounce++) {
+      int in = bounce & 1;
+      _extend_kernel.setArg(extend_arg + 1, _path_queues[in]);
+      _extend_kernel.setArg(extend_arg + 3, in);
+      _enqueue_1d(_extend_kernel, "extend", wave, _wavefront_local_size
+          , nullptr);
+      _queue.enqueueFillBuffer(_counters, (cl_int)0
+          , (in ^ 1) * sizeof(cl_int), sizeof(cl_int), nullptr
+          , _profile("clear counters"));
+      _shade_kernel.setArg(shade_arg + 1, _path_queues[in]);
+      _shade_kernel.setArg(shade_arg + 2, _path_queues[in ^ 1]);
+      _shade_kernel.setArg(shade_arg + 4, in);
+      _shade_kernel.setArg(shade_arg + 5, (cl_int)(bounce == bounces - 1));
+      _enqueue_1d(_shade_kernel, "shade", wave, _wavefront_local_size
+          , nullptr);
+    }
+  }
+
+  _accumulate_kernel.setArg(0, _sample_sum);
+  int arg = _set_output_args(&_accumulate_kernel, 1);
+  _accumulate_kernel.setArg(arg++, samples);
+  _accumulate_kernel.setArg(arg++, (cl_int)reset);
+  _accumulate_kernel.setArg(arg++, region);
+  _accumulate_kernel.setArg(arg++, _tiles);
+  _accumulate_kernel.setArg(arg++, num_tiles);
+  _enqueue_1d(_accumulate_kernel, "accumulate", wave, _wavefront_local_size
+      , &_kernel_event);
+  if (samples == 0)
+    _first_event = _kernel_event;
+}
+
+// filters the rows of `region` into the image, see atrous_kernel. what the
+// pixels see first is only traced again when it has changed or the rows are
+// new to this renderer
+void cl_renderer::_enqueue_denoise(const scene &world, bool reset
+    , const cl_int4 &region) {
+  if (!_albedo()) {
+    size_t size = (size_t)_width * _height * sizeof(cl_float4);
+    _albedo = cl::Buffer(_context, CL_MEM_READ_WRITE, size);
+    _normal_depth = cl::Buffer(_context, CL_MEM_READ_WRITE, size);
+    for (cl::Buffer &buffer : _denoised)
+      buffer = cl::Buffer(_context, CL_MEM_READ_WRITE, size);
+  }
+  size_t items = (size_t)_width * (region.s[3] - region.s[1]);
+
+  if (reset || region.s[1] < _aov_begin || region.s[3] > _aov_end) {
+    int arg = _set_scene_args(&_aov_kernel, 0, world);
+    _aov_kernel.setArg(arg++, _width);
+    _aov_kernel.setArg(arg++, _height);
+    _aov_kernel.setArg(arg++, world.cam_position);
+    _aov_kernel.setArg(arg++, _view);
+    _aov_kernel.setArg(arg++, region);
+    _aov_kernel.setArg(arg++, _albedo);
+    _aov_kernel.setArg(arg++, _normal_depth);
+    _enqueue_1d(_aov_kernel, "aovs", items, _denoise_local_size, nullptr);
+    _aov_begin = region.s[1];
+    _aov_end = region.s[3];
+  }
+
+  _denoise_input_kernel.setArg(0, _accum);
+  _denoise_input_kernel.setArg(1, _moments);
+  _denoise_input_kernel.setArg(2, _albedo);
+  _denoise_input_kernel.setArg(3, _normal_depth);
+  _denoise_input_kernel.setArg(4, _width);
+  _denoise_input_kernel.setArg(5, _height);
+  _denoise_input_kernel.setArg(6, region);
+  _denoise_input_kernel.setArg(7, _denoised[0]);
+  _enqueue_1d(_denoise_input_kernel, "denoise", items, _denoise_local_size
+      , nullptr);
+
+  _atrous_kernel.setArg(2, _albedo);
+  _atrous_kernel.setArg(3, _normal_depth);
+  _atrous_kernel.setArg(4, _width);
+  _atrous_kernel.setArg(5, _height);
+  _atrous_kernel.setArg(6, region);
+  _atrous_kernel.setArg(9, _output());
+  for (int pass = 0; pass < denoise_passes; pass++) {
+    bool last = pass == denoise_passes - 1;
+    _atrous_kernel.setArg(0, _denoised[pass & 1]);
+    _atrous_kernel.setArg(1, _denoised[(pass + 1) & 1]);
+    _atrous_kernel.setArg(7, (cl_int)(1 << pass));
+    _atrous_kernel.setArg(8, (cl_int)last);
+    // the frame ends with the last pass
+    _enqueue_1d(_atrous_kernel, "denoise", items, _denoise_local_size
+        , last ? &_kernel_event : nullptr);
+  }
+}
+
+// swaps the accumulation into the history and reprojects it back for the
+// rows of `region`, see reproject_kernel. without `history` they start over
+// but still get their first hits traced for the next launch
+void cl_renderer::_enqueue_reproject(const scene &world
+    , const cl_int4 &region, bool history, bool spheres_moved
+    , const cl_float3 &previous_cam_position, cl::Event *event) {
+  if (!_hit_ids()) {
+    size_t pixels = (size_t)_width * _height;
+    _history_accum = cl::Buffer(_context, CL_MEM_READ_WRITE
+        , pixels * sizeof(cl_float4));
+    _history_moments = cl::Buffer(_context, CL_MEM_READ_WRITE
+        , pixels * sizeof(cl_float));
+    for (cl::Buffer *buffer : { &_history_ids, &_hit_ids })
+      *buffer = cl::Buffer(_context, CL_MEM_READ_WRITE
+          , pixels * sizeof(cl_int));
+    for (cl::Buffer *buffer : { &_history_depths, &_hit_depths })
+      *buffer = cl::Buffer(_context, CL_MEM_READ_WRITE
+          , pixels * sizeof(cl_float));
+  }
+  std::swap(_accum, _history_accum);
+  std::swap(_moments, _history_moments);
+  std::swap(_hit_ids, _history_ids);
+  std::swap(_hit_depths, _history_depths);
+  if (!history)
+    _history_begin = _history_end = 0;
+
+  int arg = _set_scene_args(&_reproject_kernel, 0, world);
+  _reproject_kernel.setArg(arg++, _width);
+  _reproject_kernel.setArg(arg++, _height);
+  _reproject_kernel.setArg(arg++, world.cam_position);
+  _reproject_kernel.setArg(arg++, _view);
+  _reproject_kernel.setArg(arg++, region);
+  _reproject_kernel.setArg(arg++, history && spheres_moved ? _previous_spheres
+      : _sphere_geometry.get());
+  _reproject_kernel.setArg(arg++, previous_cam_position);
+  _reproject_kernel.setArg(arg++, (cl_int)_history_begin);
+  _reproject_kernel.setArg(arg++, (cl_int)_history_end);
+  _reproject_kernel.setArg(arg++, _history_accum);
+  _reproject_kernel.setArg(arg++, _history_moments);
+  _reproject_kernel.setArg(arg++, _history_ids);
+  _reproject_kernel.setArg(arg++, _history_depths);
+  _reproject_kernel.setArg(arg++, (cl_float)temporal_max_spp);
+  _reproject_kernel.setArg(arg++, _accum);
+  _reproject_kernel.setArg(arg++, _moments);
+  _reproject_kernel.setArg(arg++, _hit_ids);
+  _reproject_kernel.setArg(arg++, _hit_depths);
+  _enqueue_1d(_reproject_kernel, "reproject"
+      , (size_t)_width * (region.s[3] - region.s[1]), _reproject_local_size
+      , event);
+  _history_begin = region.s[1];
+  _history_end = region.s[3];
+  ++_sequence;
+}
+
+static void wait_for_fence(GLsync fence) {
+  while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000)
+      == GL_TIMEOUT_EXPIRED)
+    ;
+}
+
+// the fence of the last GL command reading the texture of `slot` as an event
+// for acquiring it. without cl_khr_gl_event the host waits for the fence
+std::vector<cl::Event> cl_renderer::_wait_for_texture(int slot) {
+  std::vector<cl::Event> events;
+  GLsync fence = _slots[slot].presented;
+  if (!fence)
+    return events;
+  if (_create_event_from_gl_sync) {
+    cl_int err;
+    cl_event event = _create_event_from_gl_sync(_context(), (cl_GLsync)fence
+        , &err);
+    if (err == CL_SUCCESS) {
+      events.push_back(cl::Event(event));
+      return events;
+    }
+  }
+  wait_for_fence(fence);
+  return events;
+}
+
+// gets the pixel buffer of `slot` ready for the device to render or read
+// into: the last upload from it has to be done and, unless it stays mapped,
+// it is mapped. zero copy buffers also are unmapped on the device, after
+// the read of the last frame mapped them for the host
+void cl_renderer::_map_pixel_buffer(int slot) {
+  frame_slot &s = _slots[slot];
+  if (_zero_copy_out && s.read()) {
+    _queue.enqueueUnmapMemObject(s.out, s.pixels);
+    s.read = cl::Event();
+  }
+  if (_persistent_map) {
+    if (s.uploaded) {
+      wait_for_fence(s.uploaded);
+      glDeleteSync(s.uploaded);
+      s.uploaded = nullptr;
+    }
+    return;
+  }
+  // invalidating lets GL hand out other memory instead of waiting for the
+  // upload
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s.pixel_buffer);
+  s.pixels = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0
+      , (size_t)_width * _height * 4 * sizeof(cl_half)
+      , GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  assertf(s.pixels, "failed to map pixel buffer");
+}
+
+// queues reading the frame rendered into `slot` into its pixel buffer once
+// the frame's last launch is done. the read queue does not wait for
+// anything queued after it
+void cl_renderer::_enqueue_pixel_read(int slot) {
+  frame_slot &s = _slots[slot];
+  std::vector<cl::Event> frame = { _kernel_event };
+  size_t size = (size_t)_width * _height * 4 * sizeof(cl_half);
+  if (_zero_copy_out)
+    _read_queue.enqueueMapBuffer(s.out, CL_FALSE, CL_MAP_READ, 0, size
+        , &frame, &s.read);
+  else
+    _read_queue.enqueueReadBuffer(s.out, CL_FALSE, 0, size, s.pixels
+        , &frame, &s.read);
+  _read_queue.flush();
+  _profile_events("read image")(s.read);
+  _upload_slot = slot;
+}
+
+// copies the frame read into the pixel buffer of `slot` into its texture
+void cl_renderer::_upload_pixel_buffer(int slot) {
+  profile_scope scope(_profiler, "texture upload");
+  frame_slot &s = _slots[slot];
+  s.read.wait();
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s.pixel_buffer);
+  if (!_persistent_map) {
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    s.pixels = nullptr;
+  }
+  glBindTexture(GL_TEXTURE_2D, s.texture);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, _width, _height, GL_RGBA
+      , GL_HALF_FLOAT, nullptr);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  // memory that stays mapped is only written again once GL is done with it
+  if (_persistent_map)
+    s.uploaded = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  if (_upload_slot == slot)
+    _upload_slot = -1;
+}
+
+int cl_renderer::render_async(const scene &world, int samples, int bounces) {
+  assertf(_slots.size() > 1, "pipelining needs at least two textures");
+  int slot = _gl_current;
+  frame_slot &s = _slots[slot];
+  {
+    profile_scope scope(_profiler, "enqueue");
+    // frames still in flight are about to be thrown away with the image
+    if (accum_invalidated(world, bounces))
+      for (int i : _in_flight)
+        _slots[i].pending_samples = 0;
+    enqueue(world, samples, bounces, 0, _height);
+  }
+  profile_scope scope(_profiler, "wait");
+  int finished = -1;
+  if (!_kernel_pending) {
+    // converged, nothing new will come so let the rest finish
+    while (!_in_flight.empty())
+      finished = _wait_frame();
+    _queue.finish();
+    _samples += _pending_samples;
+    _pending_samples = 0;
+    return finished;
+  }
+  s.pending_samples = _pending_samples;
+  _pending_samples = 0;
+  s.rays = 0;
+  if (_count_rays) {
+    _queue.enqueueReadBuffer(_ray_count, CL_FALSE, 0, sizeof(s.rays), &s.rays
+        , nullptr, _profile("read ray count"));
+    _queue.enqueueFillBuffer(_ray_count, (cl_uint)0, 0, sizeof(cl_uint)
+        , nullptr, _profile("clear ray count"));
+  }
+  _queue.enqueueMarker(&s.done);
+  _queue.flush();
+  ++_frame;
+  _in_flight.push_back(slot);
+  _gl_current = (_gl_current + 1) % _slots.size();
+  // the texture that is drawn keeps one slot out of the ring
+  while (_in_flight.size() > _slots.size() - 1)
+    finished = _wait_frame();
+  return finished;
+}
+
+// waits for the oldest frame in flight and returns its slot
+int cl_renderer::_wait_frame() {
+  int slot = _in_flight.front();
+  _in_flight.pop_front();
+  frame_slot &s = _slots[slot];
+  s.done.wait();
+  if (_pixel_buffers)
+    _upload_pixel_buffer(slot);
+  _samples += s.pending_samples;
+  _rays += s.rays;
+  return slot;
+}
+
+void cl_renderer::set_texture_fence(int texture, GLsync fence) {
+  GLsync &presented = _slots[texture].presented;
+  if (presented)
+    glDeleteSync(presented);
+  presented = fence;
+}
+
+void cl_renderer::finish() {
+  while (!_in_flight.empty())
+    _wait_frame();
+  if (_count_rays) {
+    cl_uint rays;
+    _queue.enqueueReadBuffer(_ray_count, CL_FALSE, 0, sizeof(rays), &rays
+        , nullptr, _profile("read ray count"));
+    _queue.enqueueFillBuffer(_ray_count, (cl_uint)0, 0, sizeof(cl_uint)
+        , nullptr, _profile("clear ray count"));
+    _queue.finish();
+    _rays += rays;
+  } else
+    _queue.finish();
+  // what render() queued, frames of render_async() are uploaded as they
+  // are waited for
+  if (_upload_slot >= 0)
+    _upload_pixel_buffer(_upload_slot);
+  ++_frame;
+  _samples += _pending_samples;
+  _pending_samples = 0;
+}
+
+double cl_renderer::get_kernel_ms() {
+  if (!_kernel_pending)
+    return 0;
+  cl_ulong start = _first_event.getProfilingInfo<CL_PROFILING_COMMAND_START>()
+    , end = _kernel_event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+  return (end - start) / 1e6;
+}
+
+const cl::Device& cl_renderer::get_device() {
+  return _device;
+}
+
+void cl_renderer::read_rgba8(std::vector<uint8_t> *rgba) {
+  rgba->resize((size_t)_width * _height * 4);
+  read_rgba8_rows(0, _height, rgba->data());
+}
+
+void cl_renderer::read_radiance(std::vector<float> *rgba) {
+  rgba->resize((size_t)_width * _height * 4);
+  read_radiance_rows(0, _height, rgba->data());
+}
+
+unsigned long long int cl_renderer::get_accumulated_samples() {
+  return _samples;
+}
+
+void cl_renderer::set_wavefront(bool wavefront) {
+  _wavefront = wavefront;
+}
+
+void cl_renderer::set_adaptive(float threshold) {
+  _adaptive_threshold = threshold;
+}
+
+void cl_renderer::set_nee(bool nee) {
+  _nee = nee;
+}
+
+void cl_renderer::set_count_rays(bool count) {
+  if (count != _count_rays) {
+    _count_rays = count;
+    _build_program();
+  }
+  if (count) {
+    _queue.enqueueFillBuffer(_ray_count, (cl_uint)0, 0, sizeof(cl_uint));
+    _rays = 0;
+  }
+}
+
+void cl_renderer::set_sampler(sampler_type sampler) {
+  if (sampler != _sampler) {
+    _sampler = sampler;
+    _build_program();
+  }
+}
+
+void cl_renderer::set_denoise(bool denoise) {
+  _denoise = denoise;
+  // nothing is denoised until the next launch traces the first hits
+  _aov_begin = _aov_end = 0;
+}
+
+void cl_renderer::set_view(int x, int y, int full_width, int full_height) {
+  _view = {{ x, y, full_width, full_height }};
+}
+
+void cl_renderer::set_temporal(bool temporal) {
+  _temporal = temporal;
+  // nothing to reproject until a launch has traced the first hits
+  _history_begin = _history_end = 0;
+}
+
+unsigned long long int cl_renderer::get_ray_count() {
+  return _rays;
+}
+
+std::string cl_renderer::get_name() {
+  return _device.getInfo<CL_DEVICE_NAME>();
+}
+
+void cl_renderer::set_specialise(bool specialise, bool wait) {
+  _specialise = specialise;
+  _specialise_wait = wait;
+}
+
+void cl_renderer::set_profiler(frame_profiler *profiler) {
+  set_profiler(profiler, get_name());
+}
+
+void cl_renderer::set_profiler(frame_profiler *profiler
+    , const std::string &track) {
+  _profiler = profiler;
+  _profile_track = track;
+}
+
+void cl_renderer::read_rgba8_rows(int y_begin, int y_end, uint8_t *dst) {
+  if (y_begin >= y_end)
+    return;
+  assertf(_out(), "image is in an OpenGL texture");
+  size_t row = (size_t)_width * sizeof(cl_uchar4);
+  _queue.enqueueReadBuffer(_out, CL_TRUE, y_begin * row
+      , (y_end - y_begin) * row, dst + y_begin * row, nullptr
+      , _profile("read image"));
+}
+
+void cl_renderer::_copy_rows(const cl::Buffer &buffer, size_t pixel_size
+    , int y_begin, int y_end, void *host, bool write) {
+  if (y_begin >= y_end)
+    return;
+  size_t row = (size_t)_width * pixel_size;
+  char *rows = (char*)host + y_begin * row;
+  if (write)
+    _queue.enqueueWriteBuffer(buffer, CL_TRUE, y_begin * row
+        , (y_end - y_begin) * row, rows, nullptr, _profile("write rows"));
+  else
+    _queue.enqueueReadBuffer(buffer, CL_TRUE, y_begin * row
+        , (y_end - y_begin) * row, rows, nullptr, _profile("read rows"));
+}
+
+void cl_renderer::read_accum_rows(int y_begin, int y_end, float *dst) {
+  _copy_rows(_accum, sizeof(cl_float4), y_begin, y_end, dst, false);
+}
+
+void cl_renderer::read_radiance_rows(int y_begin, int y_end, float *dst) {
+  // the last filter pass leaves the radiance in _denoised
+  if (_denoise && _aov_begin < _aov_end) {
+    _copy_rows(_denoised[denoise_passes & 1], sizeof(cl_float4), y_begin
+        , y_end, dst, false);
+    return;
+  }
+  read_accum_rows(y_begin, y_end, dst);
+  if (y_begin < y_end)
+    resolve_accum(dst + (size_t)y_begin * _width * 4
+        , (size_t)(y_end - y_begin) * _width);
+}
+
+void cl_renderer::write_accum_rows(int y_begin, int y_end, const float *src) {
+  _copy_rows(_accum, sizeof(cl_float4), y_begin, y_end, (void*)src, true);
+}
+
+void cl_renderer::read_moment_rows(int y_begin, int y_end, float *dst) {
+  _copy_rows(_moments, sizeof(cl_float), y_begin, y_end, dst, false);
+}
+
+void cl_renderer::write_moment_rows(int y_begin, int y_end, const float *src) {
+  _copy_rows(_moments, sizeof(cl_float), y_begin, y_end, (void*)src, true);
+}
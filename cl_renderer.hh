@@ -0,0 +1,238 @@
+#pragma once
+
+#include "renderer.hh"
+#include "profiler.hh"
+#include "scene_buffer.hh"
+#include <GL/glew.h>
+#include <CL/cl.hpp>
+#include <deque>
+#include <future>
+#include <list>
+
+// progressive path tracer on a single OpenCL device. the image either goes
+// straight into OpenGL textures through cl_khr_gl_sharing or, when no
+// texture is given, into a plain buffer that can be read back. devices that
+// cannot share textures render into buffers that are read into pixel buffer
+// objects and uploaded from there. rendering can be restricted to a range of
+// rows so that several devices share a frame. with several textures frames
+// can be pipelined, see render_async(), which also lets the reads of one
+// frame overlap the rendering of the next
+class cl_renderer : public renderer {
+  // a frame of the pipeline and the texture it renders into
+  struct frame_slot {
+    // the frame's commands have completed
+    cl::Event done;
+    // follows the last GL command that reads the texture
+    GLsync presented;
+    int pending_samples;
+    cl_uint rays;
+    // without interop: the texture, the pixel buffer object it is uploaded
+    // from and where that is mapped, null while it is not, the buffer the
+    // frame renders into, its read into the pixel buffer and the fence of
+    // the upload from there
+    GLuint texture, pixel_buffer;
+    void *pixels;
+    cl::Buffer out;
+    cl::Event read;
+    GLsync uploaded;
+  };
+  // render_kernel built for fixed launch parameters
+  struct variant {
+    std::string build_options;
+    cl::Program program;
+    cl::Kernel kernel;
+    size_t local_size;
+  };
+  cl::Device _device;
+  cl::Context _context;
+  cl::CommandQueue _queue;
+  // without interop, images are read on a queue of their own so that the
+  // reads wait for their frame but not the frame after. pixel buffers stay
+  // mapped where GL_ARB_buffer_storage allows it, and then are where the
+  // device renders into if it shares memory with the host
+  bool _pixel_buffers, _persistent_map, _zero_copy_out;
+  cl::CommandQueue _read_queue;
+  std::string _build_options;
+  // what _program was built from, specialised builds take the same
+  std::string _source;
+  cl::Program _program;
+  cl::Kernel _kernel;
+  // specialised builds of _kernel, the most recently used first, and the
+  // one being built in the background
+  bool _specialise, _specialise_wait;
+  std::list<variant> _variants;
+  std::future<variant> _pending_variant;
+  // what changes while the scene is animated, updated in place
+  scene_buffer _sphere_geometry, _sphere_materials, _sphere_nodes
+    , _sphere_indices, _lights;
+  // how much local memory kernels may stage spheres in, 0 for none
+  size_t _local_sphere_bytes;
+  cl::Buffer _accum, _moments, _out;
+  cl::Buffer _vertices, _triangles, _materials, _triangle_nodes
+    , _triangle_indices;
+  // rays traced by the last frame when counting them
+  cl::Buffer _ray_count;
+  // the tile SAMPLER_BLUE_NOISE shifts sample points by
+  cl::Buffer _blue_noise;
+  // one image per texture, frames go round them
+  std::vector<cl::Memory> _gl_objs;
+  int _gl_current;
+  // slot of the frame render() still has to upload, -1 for none
+  int _upload_slot;
+  std::vector<frame_slot> _slots;
+  // slots of the frames queued by render_async() that are not waited for
+  std::deque<int> _in_flight;
+  // clCreateEventFromGLsyncKHR of cl_khr_gl_event, null without it
+  cl_event (CL_API_CALL *_create_event_from_gl_sync)(cl_context, cl_GLsync
+      , cl_int*);
+  // the wavefront path tracer and its path state, allocated on first use
+  cl::Kernel _generate_kernel, _extend_kernel, _shade_kernel
+    , _accumulate_kernel;
+  cl::Buffer _paths, _path_queues[2], _counters, _sample_sum;
+  size_t _wavefront_local_size;
+  // the denoiser and its buffers, allocated on first use: what pixels see
+  // first, traced for rows [_aov_begin, _aov_end), and the image between
+  // filter passes
+  bool _denoise;
+  cl::Kernel _aov_kernel, _denoise_input_kernel, _atrous_kernel;
+  cl::Buffer _albedo, _normal_depth, _denoised[2];
+  size_t _denoise_local_size;
+  int _aov_begin, _aov_end;
+  // temporal reuse and its buffers, allocated on first use: the
+  // accumulation of the launch before and what the centres of its pixels
+  // saw first, valid for rows [_history_begin, _history_end), the same for
+  // this launch, and where the spheres were before the last upload
+  bool _temporal;
+  cl::Kernel _reproject_kernel;
+  cl::Buffer _history_accum, _history_moments, _history_ids
+    , _history_depths, _hit_ids, _hit_depths, _previous_spheres;
+  size_t _reproject_local_size, _previous_spheres_capacity;
+  int _history_begin, _history_end;
+  // the sobol samplers take a new sequence with every reprojection so that
+  // samples carried over are not drawn again
+  unsigned int _sequence;
+  // first and last launch of a frame
+  cl::Event _first_event, _kernel_event;
+  int _width, _height;
+  // see set_view()
+  cl_int4 _view;
+  size_t _local_work_size;
+  // what was last rendered is remembered so that any change to the scene,
+  // camera or bounce count restarts accumulation without callers having to
+  // flag it
+  const scene *_last_scene;
+  unsigned long long int _last_version, _last_mesh_version;
+  cl_float3 _last_cam_position;
+  int _last_bounces;
+  cl_int4 _last_view;
+  unsigned int _frame;
+  unsigned long long int _samples;
+  int _pending_samples;
+  bool _kernel_pending;
+  bool _wavefront;
+  bool _nee;
+  bool _count_rays;
+  sampler_type _sampler;
+  unsigned long long int _rays;
+  frame_profiler *_profiler;
+  std::string _profile_track;
+  // adaptive sampling, off at 0
+  float _adaptive_threshold;
+  cl::Kernel _tile_error_kernel;
+  cl::Buffer _tiles, _tile_error;
+  int _tiles_x, _tiles_y;
+  std::vector<float> _tile_errors;
+  std::vector<cl_int> _tile_list;
+  size_t _vertices_capacity, _triangles_capacity, _materials_capacity
+    , _triangle_nodes_capacity, _triangle_indices_capacity;
+  // reused for the indices of changed spheres and nodes
+  std::vector<int> _changed_spheres, _changed_sphere_nodes;
+
+  std::string _program_options();
+  void _build_program();
+  cl::Kernel& _select_render_kernel(int samples, int bounces
+      , size_t *local_size);
+  // event of the next command of `stage` while profiling, nullptr otherwise
+  cl::Event* _profile(const char *stage);
+  // adds commands of `stage` whose events are kept elsewhere to the profile
+  std::function<void(const cl::Event&)> _profile_events(const char *stage);
+  // true if only what the last commits changed was uploaded
+  bool _upload_spheres(const scene &world);
+  int _set_scene_args(cl::Kernel *kernel, int first, const scene &world);
+  cl::Memory _output();
+  int _set_output_args(cl::Kernel *kernel, int first);
+  void _enqueue_1d(const cl::Kernel &kernel, const char *stage, size_t size
+      , size_t local_size, cl::Event *event);
+  void _enqueue_wavefront(const scene &world, int samples, int bounces
+      , bool reset, const cl_int4 &region, cl_int num_tiles, size_t wave);
+  void _enqueue_denoise(const scene &world, bool reset
+      , const cl_int4 &region);
+  void _enqueue_reproject(const scene &world, const cl_int4 &region
+      , bool history, bool spheres_moved
+      , const cl_float3 &previous_cam_position, cl::Event *event);
+  int _select_tiles(const cl_int4 &region, int samples, int *tile_samples);
+  void _copy_rows(const cl::Buffer &buffer, size_t pixel_size, int y_begin
+      , int y_end, void *host, bool write);
+  std::vector<cl::Event> _wait_for_texture(int slot);
+  void _map_pixel_buffer(int slot);
+  void _enqueue_pixel_read(int slot);
+  void _upload_pixel_buffer(int slot);
+  int _wait_frame();
+public:
+  // gl_texs require the GL context they belong to be current, also when the
+  // renderer is destroyed. without `gl_sharing` the device does not render
+  // into them directly but through pixel buffer objects
+  cl_renderer(const cl::Platform &platform, const cl::Device &device
+      , int width, int height, const std::vector<GLuint> &gl_texs
+      , bool gl_sharing = true);
+  ~cl_renderer();
+  void render(const scene &world, int samples, int bounces);
+  void read_rgba8(std::vector<uint8_t> *rgba);
+  void read_radiance(std::vector<float> *rgba);
+  unsigned long long int get_accumulated_samples();
+  void set_wavefront(bool wavefront);
+  void set_adaptive(float threshold);
+  void set_nee(bool nee);
+  void set_count_rays(bool count);
+  void set_sampler(sampler_type sampler);
+  void set_denoise(bool denoise);
+  void set_temporal(bool temporal);
+  void set_view(int x, int y, int full_width, int full_height);
+  unsigned long long int get_ray_count();
+  std::string get_name();
+  void set_specialise(bool specialise, bool wait);
+  // commands go on a track named after the device
+  void set_profiler(frame_profiler *profiler);
+  void set_profiler(frame_profiler *profiler, const std::string &track);
+
+  // pipelined rendering into the textures in turn: queues a frame into the
+  // next texture without waiting for it, so that the device renders while
+  // the host presents and updates. only once frames are in flight in all but
+  // one texture, the oldest is waited for. returns the texture of the newest
+  // frame that has completed and can be drawn, or -1 if none did
+  int render_async(const scene &world, int samples, int bounces);
+  // `fence` follows the last GL command reading texture `texture`. the next
+  // frame rendered into it waits for the fence, not for all of GL to finish
+  void set_texture_fence(int texture, GLsync fence);
+
+  bool accum_invalidated(const scene &world, int bounces);
+  // queues rendering of rows [y_begin, y_end) without waiting for it
+  void enqueue(const scene &world, int samples, int bounces, int y_begin
+      , int y_end);
+  void finish();
+  // device time of the last frame, from its first launch to its last
+  double get_kernel_ms();
+  const cl::Device& get_device();
+  // access to rows [y_begin, y_end) for merging images and moving accumulated
+  // samples between devices. pointers are to the start of a whole image.
+  // rgba8 rows are only there when rendering without a texture
+  void read_rgba8_rows(int y_begin, int y_end, uint8_t *dst);
+  void read_accum_rows(int y_begin, int y_end, float *dst);
+  // linear radiance as read_radiance() gives it
+  void read_radiance_rows(int y_begin, int y_end, float *dst);
+  void write_accum_rows(int y_begin, int y_end, const float *src);
+  // sums of squared sample luminances, one float per pixel
+  void read_moment_rows(int y_begin, int y_end, float *dst);
+  void write_moment_rows(int y_begin, int y_end, const float *src);
+};
+
@@ -0,0 +1,1169 @@
+#include "cpu_renderer.hh"
+#include "blue_noise.hh"
+#include "simd.hh"
+#include "profiler.hh"
+#include "utils.hh"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// everything that traces and shades follows its namesake in
+// opencl_kernel.cl, so that both backends render the same image. changes to
+// one need to go to the other
+
+static const float EPSILON = 0.00003f;
+static const float PI = 3.14159265358979323846f;
+static const float inf = 1e20f;
+
+struct vec3 {
+  float x, y, z;
+};
+
+static inline vec3 operator+(const vec3 &a, const vec3 &b) {
+  return { a.x + b.x, a.y + b.y, a.z + b.z };
+}
+
+static inline vec3 operator-(const vec3 &a, const vec3 &b) {
+  return { a.x - b.x, a.y - b.y, a.z - b.z };
+}
+
+static inline vec3 operator*(const vec3 &a, const vec3 &b) {
+  return { a.x * b.x, a.y * b.y, a.z * b.z };
+}
+
+static inline vec3 operator*(const vec3 &a, float f) {
+  return { a.x * f, a.y * f, a.z * f };
+}
+
+static inline vec3 operator/(const vec3 &a, float f) {
+  return { a.x / f, a.y / f, a.z / f };
+}
+
+static inline vec3& operator+=(vec3 &a, const vec3 &b) {
+  return a = a + b;
+}
+
+static inline float dot(const vec3 &a, const vec3 &b) {
+  return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static inline vec3 cross(const vec3 &a, const vec3 &b) {
+  return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z
+    , a.x * b.y - a.y * b.x };
+}
+
+static inline vec3 normalize(const vec3 &a) {
+  return a * (1.f / std::sqrt(dot(a, a)));
+}
+
+// also takes cl_float4, which is the same type
+static inline vec3 to_vec3(const cl_float3 &v) {
+  return { v.s[0], v.s[1], v.s[2] };
+}
+
+struct ray {
+  vec3 origin;
+  vec3 dir;
+};
+
+// rays of a packet, one per lane. `t` is how far a lane looks for hits and
+// then where it found the closest one, `hit_id` what that was, encoded like
+// in the kernel. lanes not in `active` are ignored
+struct ray_packet {
+  vfloat3 origin, dir, inv_dir;
+  vfloat t;
+  vint hit_id;
+  vint active;
+
+  ray get(int lane) const {
+    return { { origin.x[lane], origin.y[lane], origin.z[lane] }
+      , { dir.x[lane], dir.y[lane], dir.z[lane] } };
+  }
+
+  void set(int lane, const ray &r) {
+    origin.x[lane] = r.origin.x;
+    origin.y[lane] = r.origin.y;
+    origin.z[lane] = r.origin.z;
+    dir.x[lane] = r.dir.x;
+    dir.y[lane] = r.dir.y;
+    dir.z[lane] = r.dir.z;
+  }
+
+  // inv_direction
+  void update_inv_dir() {
+    inv_dir = { select(vabs(dir.x) > 1e-30f, 1.f / dir.x, splat(1e30f))
+      , select(vabs(dir.y) > 1e-30f, 1.f / dir.y, splat(1e30f))
+      , select(vabs(dir.z) > 1e-30f, 1.f / dir.z, splat(1e30f)) };
+  }
+};
+
+static uint32_t wang_hash(uint32_t seed) {
+  seed = (seed ^ 61) ^ (seed >> 16);
+  seed *= 9;
+  seed = seed ^ (seed >> 4);
+  seed *= 0x27d4eb2d;
+  seed = seed ^ (seed >> 15);
+  return seed;
+}
+
+static uint32_t rand_xorshift(uint32_t *rng_state) {
+  *rng_state ^= (*rng_state << 13);
+  *rng_state ^= (*rng_state >> 17);
+  *rng_state ^= (*rng_state << 5);
+  return *rng_state;
+}
+
+static float random(uint32_t *rng_state) {
+  return (float)((float)rand_xorshift(rng_state) * (1.0 / 4294967296.0));
+}
+
+// Sampler, with the sampler the kernel is built with and its blue noise
+struct path_sampler {
+  sampler_type type;
+  const float *blue_noise;
+  uint32_t state;
+  uint32_t index;
+  uint32_t dimension;
+  uint32_t texel;
+};
+
+static path_sampler make_sampler(sampler_type type, int x, int y, int width
+    , uint32_t frame, uint32_t sequence) {
+  path_sampler s;
+  s.type = type;
+  s.blue_noise = blue_noise().data();
+  uint32_t scramble = sequence ? wang_hash(sequence) : 0;
+  s.state = type == sampler_type::random
+    ? wang_hash(wang_hash(frame) ^ (y * width + x))
+    : type == sampler_type::sobol ? wang_hash(y * width + x) ^ scramble
+    : scramble;
+  s.index = 0;
+  s.dimension = 0;
+  s.texel = y % blue_noise_size * blue_noise_size + x % blue_noise_size;
+  return s;
+}
+
+static void start_sample(path_sampler *s, uint32_t index) {
+  s->index = index;
+  s->dimension = 0;
+}
+
+static uint32_t reverse_bits(uint32_t x) {
+  x = (x << 16) | (x >> 16);
+  x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+  x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+  x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+  x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+  return x;
+}
+
+static uint32_t hash_combine(uint32_t seed, uint32_t v) {
+  return seed ^ (v + (seed << 6) + (seed >> 2));
+}
+
+static uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+  x = reverse_bits(x);
+  x += seed;
+  x ^= x * 0x6c50b47cu;
+  x ^= x * 0xb82f1e52u;
+  x ^= x * 0xc7afe638u;
+  x ^= x * 0x8d22f6e6u;
+  return reverse_bits(x);
+}
+
+static uint32_t sobol_1(uint32_t i) {
+  uint32_t x = 0;
+  for (uint32_t v = 1u << 31; i; i >>= 1, v ^= v >> 1)
+    if (i & 1)
+      x ^= v;
+  return x;
+}
+
+static float bits_to_float(uint32_t x) {
+  return (float)(x >> 8) * (1.f / 16777216.f);
+}
+
+static float blue_noise_at(const float *noise, uint32_t texel, uint32_t k) {
+  float step_x = (float)k * 0.7548776662f, step_y = (float)k * 0.5698402910f;
+  int offset_x = (int)((step_x - std::floor(step_x)) * (float)blue_noise_size)
+    , offset_y = (int)((step_y - std::floor(step_y)) * (float)blue_noise_size);
+  int x = (texel % blue_noise_size + offset_x) % blue_noise_size
+    , y = (texel / blue_noise_size + offset_y) % blue_noise_size;
+  return noise[y * blue_noise_size + x];
+}
+
+static void sample_2d(path_sampler *s, float u[2]) {
+  if (s->type == sampler_type::random) {
+    u[0] = random(&s->state);
+    u[1] = random(&s->state);
+    return;
+  }
+  uint32_t seed = hash_combine(s->state, wang_hash(s->dimension));
+  uint32_t index = nested_uniform_scramble(s->index, seed);
+  u[0] = bits_to_float(nested_uniform_scramble(reverse_bits(index)
+        , hash_combine(seed, 1)));
+  u[1] = bits_to_float(nested_uniform_scramble(sobol_1(index)
+        , hash_combine(seed, 2)));
+  if (s->type == sampler_type::blue_noise)
+    for (int c = 0; c < 2; c++) {
+      u[c] += blue_noise_at(s->blue_noise, s->texel, 2 * s->dimension + c + 1);
+      u[c] -= std::floor(u[c]);
+    }
+  s->dimension++;
+}
+
+static float sample_1d(path_sampler *s) {
+  float u[2];
+  sample_2d(s, u);
+  return u[0];
+}
+
+static ray create_cam_ray(int x_coord, int y_coord, int width, int height
+    , const vec3 &cam_pos, const float jitter[2]) {
+  float fx = ((float)x_coord + jitter[0]) / (float)width;
+  float fy = ((float)y_coord + jitter[1]) / (float)height;
+  float aspect_ratio = (float)width / (float)height;
+  vec3 pixel_pos = { (fx - 0.5f) * aspect_ratio, fy - 0.5f, 0.f };
+  return { cam_pos, normalize(pixel_pos - cam_pos) };
+}
+
+// `sphere` is the centre and squared radius, as in scene::sphere_geometry
+static float intersect_sphere(const cl_float4 &sphere, const ray &r) {
+  vec3 ray_to_center = to_vec3(sphere) - r.origin;
+  float b = dot(ray_to_center, r.dir);
+  float c = dot(ray_to_center, ray_to_center) - sphere.s[3];
+  float disc = b * b - c;
+  if (disc < 0.f)
+    return 0.f;
+  disc = std::sqrt(disc);
+  if ((b - disc) > EPSILON)
+    return b - disc;
+  if ((b + disc) > EPSILON)
+    return b + disc;
+  return 0.f;
+}
+
+// the primitive tests take one primitive against all lanes. with `any_hit`
+// lanes that hit are done and leave `active`
+static void intersect_sphere(const cl_float4 &sphere, int id, bool any_hit
+    , ray_packet *p) {
+  vfloat3 ray_to_center = splat3(sphere.s) - p->origin;
+  vfloat b = dot(ray_to_center, p->dir);
+  vfloat c = dot(ray_to_center, ray_to_center) - sphere.s[3];
+  vfloat disc = b * b - c;
+  vint hit = p->active & (disc >= 0.f);
+  disc = vsqrt(vmax(disc, splat(0.f)));
+  vfloat t = select(b - disc > EPSILON, b - disc
+      , select(b + disc > EPSILON, b + disc, splat(0.f)));
+  hit &= (t != 0.f) & (t < p->t);
+  p->t = select(hit, t, p->t);
+  p->hit_id = select(hit, splat(id), p->hit_id);
+  if (any_hit)
+    p->active &= ~hit;
+}
+
+static void intersect_triangle(const scene &world, int id, bool any_hit
+    , ray_packet *p) {
+  const cl_int4 &tri = world.triangles[id];
+  vfloat3 v0 = splat3(world.vertices[tri.s[0]].s)
+    , e1 = splat3(world.vertices[tri.s[1]].s) - v0
+    , e2 = splat3(world.vertices[tri.s[2]].s) - v0;
+  vfloat3 pv = cross(p->dir, e2);
+  vfloat det = dot(e1, pv);
+  vint hit = p->active & (vabs(det) >= 1e-12f);
+  vfloat inv_det = 1.f / det;
+
+  vfloat3 s = p->origin - v0;
+  vfloat u = dot(s, pv) * inv_det;
+  hit &= (u >= 0.f) & (u <= 1.f);
+  vfloat3 q = cross(s, e1);
+  vfloat v = dot(p->dir, q) * inv_det;
+  hit &= (v >= 0.f) & (u + v <= 1.f);
+
+  vfloat t = dot(e2, q) * inv_det;
+  hit &= (t > EPSILON) & (t < p->t);
+  p->t = select(hit, t, p->t);
+  p->hit_id = select(hit, splat(~id), p->hit_id);
+  if (any_hit)
+    p->active &= ~hit;
+}
+
+// lanes that enter the box of `node` before their `t`
+static vint intersect_node(const bvh_node &node, const ray_packet &p) {
+  vfloat t0 = (node.bmin[0] - p.origin.x) * p.inv_dir.x
+    , t1 = (node.bmax[0] - p.origin.x) * p.inv_dir.x;
+  vfloat t_enter = vmin(t0, t1), t_exit = vmax(t0, t1);
+  t0 = (node.bmin[1] - p.origin.y) * p.inv_dir.y;
+  t1 = (node.bmax[1] - p.origin.y) * p.inv_dir.y;
+  t_enter = vmax(t_enter, vmin(t0, t1));
+  t_exit = vmin(t_exit, vmax(t0, t1));
+  t0 = (node.bmin[2] - p.origin.z) * p.inv_dir.z;
+  t1 = (node.bmax[2] - p.origin.z) * p.inv_dir.z;
+  t_enter = vmax(t_enter, vmin(t0, t1));
+  t_exit = vmin(vmin(t_exit, vmax(t0, t1)), p.t);
+  return p.active & (t_enter <= t_exit) & (t_exit > 0.f);
+}
+
+// packet version of intersect_bvh: a node is visited while any lane still
+// enters it, and the child nearer along the packet's average direction comes
+// first. `intersect(primitive, p)` tests a leaf's primitives
+template <typename intersect_fn>
+static void intersect_bvh(const bvh &tree, ray_packet *p
+    , const intersect_fn &intersect) {
+  if (tree.nodes.empty())
+    return;
+  vec3 dir = { 0.f, 0.f, 0.f };
+  for (int i = 0; i < SIMD_WIDTH; i++)
+    if (p->active[i])
+      dir += { p->dir.x[i], p->dir.y[i], p->dir.z[i] };
+
+  // every inner node swaps itself for its two children
+  int stack[bvh::max_depth + 2];
+  int stack_size = 0;
+  stack[stack_size++] = 0;
+  while (stack_size > 0) {
+    const bvh_node &node = tree.nodes[stack[--stack_size]];
+    if (!any(intersect_node(node, *p)))
+      continue;
+    if (node.count > 0) {
+      for (int i = node.left_first; i < node.left_first + node.count; i++)
+        intersect(tree.indices[i], p);
+      // any-hit packets are done once every lane has hit
+      if (!any(p->active))
+        return;
+      continue;
+    }
+    const bvh_node &left = tree.nodes[node.left_first]
+      , &right = tree.nodes[node.left_first + 1];
+    vec3 left_to_right = {
+      right.bmin[0] + right.bmax[0] - left.bmin[0] - left.bmax[0]
+      , right.bmin[1] + right.bmax[1] - left.bmin[1] - left.bmax[1]
+      , right.bmin[2] + right.bmax[2] - left.bmin[2] - left.bmax[2] };
+    bool left_first = dot(left_to_right, dir) >= 0.f;
+    stack[stack_size++] = node.left_first + (left_first ? 1 : 0);
+    stack[stack_size++] = node.left_first + (left_first ? 0 : 1);
+  }
+}
+
+// closest hits of the active lanes. lanes that miss everything end up with
+// `t` == inf
+static void intersect_scene(const scene &world, ray_packet *p) {
+  p->t = splat(inf);
+  p->hit_id = splat(0);
+  p->update_inv_dir();
+  intersect_bvh(world.sphere_bvh, p, [&](int id, ray_packet *p) {
+        intersect_sphere(world.sphere_geometry[id], id, false, p);
+      });
+  if (!world.triangles.empty())
+    intersect_bvh(world.triangle_bvh, p, [&](int id, ray_packet *p) {
+          intersect_triangle(world, id, false, p);
+        });
+}
+
+// active lanes with something in the way before their `t`
+static vint occluded(const scene &world, ray_packet *p) {
+  vint active = p->active;
+  p->update_inv_dir();
+  intersect_bvh(world.sphere_bvh, p, [&](int id, ray_packet *p) {
+        intersect_sphere(world.sphere_geometry[id], id, true, p);
+      });
+  if (any(p->active) && !world.triangles.empty())
+    intersect_bvh(world.triangle_bvh, p, [&](int id, ray_packet *p) {
+          intersect_triangle(world, id, true, p);
+        });
+  return active & ~p->active;
+}
+
+static void surface_at(const scene &world, int hit_id, const vec3 &hitpoint
+    , vec3 *normal, vec3 *color, vec3 *emission) {
+  if (hit_id >= 0) {
+    *normal = normalize(hitpoint - to_vec3(world.sphere_geometry[hit_id]));
+    const Material &material = world.sphere_materials[hit_id];
+    *color = to_vec3(material.color);
+    *emission = to_vec3(material.emission);
+  } else {
+    const cl_int4 &tri = world.triangles[~hit_id];
+    vec3 v0 = to_vec3(world.vertices[tri.s[0]]);
+    *normal = normalize(cross(to_vec3(world.vertices[tri.s[1]]) - v0
+          , to_vec3(world.vertices[tri.s[2]]) - v0));
+    const Material &material = world.materials[tri.s[3]];
+    *color = to_vec3(material.color);
+    *emission = to_vec3(material.emission);
+  }
+}
+
+static vec3 background() {
+  return { 0.15f, 0.15f, 0.25f };
+}
+
+static void make_frame(const vec3 &w, vec3 *u, vec3 *v) {
+  vec3 axis = std::fabs(w.x) > EPSILON ? vec3{ 0.f, 1.f, 0.f }
+    : vec3{ 1.f, 0.f, 0.f };
+  *u = normalize(cross(axis, w));
+  *v = cross(w, *u);
+}
+
+static float sphere_cone_width(const cl_float4 &light, const vec3 &p
+    , vec3 *to_light, float *dist2) {
+  *to_light = to_vec3(light) - p;
+  *dist2 = dot(*to_light, *to_light);
+  float sin2_max = light.s[3] / *dist2;
+  if (sin2_max >= 1.f)
+    return 0.f;
+  return sin2_max / (1.f + std::sqrt(1.f - sin2_max));
+}
+
+static float sphere_cone_pdf(const cl_float4 &light, const vec3 &p) {
+  vec3 to_light;
+  float dist2;
+  float width = sphere_cone_width(light, p, &to_light, &dist2);
+  return width > 0.f ? 1.f / (2.f * PI * width) : 0.f;
+}
+
+static float sample_sphere_cone(const cl_float4 &light, const vec3 &p, vec3 *dir
+    , const float r[2]) {
+  vec3 to_light;
+  float dist2;
+  float width = sphere_cone_width(light, p, &to_light, &dist2);
+  if (width <= 0.f)
+    return 0.f;
+  float cos_theta = 1.f - r[0] * width;
+  float sin_theta = std::sqrt(std::max(0.f, 1.f - cos_theta * cos_theta));
+  float phi = 2.f * PI * r[1];
+  vec3 w = to_light * (1.f / std::sqrt(dist2)), u, v;
+  make_frame(w, &u, &v);
+  *dir = normalize(u * std::cos(phi) * sin_theta
+      + v * std::sin(phi) * sin_theta + w * cos_theta);
+  return 1.f / (2.f * PI * width);
+}
+
+static float power_heuristic(float pdf, float other_pdf) {
+  return pdf * pdf / (pdf * pdf + other_pdf * other_pdf);
+}
+
+// the shadow ray of next event estimation and the light it brings unless it
+// is blocked before `t_max`. 0 `t_max` when there is none
+struct light_sample {
+  ray shadow_ray;
+  float t_max;
+  vec3 radiance;
+};
+
+// diffuse_bounce of the kernel, except that the shadow ray is handed back in
+// `nee` to be traced together with those of the other lanes
+static bool diffuse_bounce(const scene &world, int num_lights, int hit_id
+    , float t, bool last, ray *r, vec3 *mask, float *pdf, vec3 *accum_color
+    , path_sampler *sampler, light_sample *nee) {
+  vec3 hitpoint = r->origin + r->dir * t;
+  vec3 normal, color, emission;
+  surface_at(world, hit_id, hitpoint, &normal, &color, &emission);
+  vec3 normal_facing = dot(normal, r->dir) < 0.f ? normal : normal * (-1.f);
+
+  float weight = 1.f;
+  if (num_lights > 0 && *pdf > 0.f && hit_id >= 0
+      && (emission.x > 0.f || emission.y > 0.f || emission.z > 0.f))
+    weight = power_heuristic(*pdf
+        , sphere_cone_pdf(world.sphere_geometry[hit_id], r->origin)
+        / num_lights);
+  *accum_color += *mask * emission * weight;
+
+  vec3 origin = hitpoint + normal_facing * EPSILON;
+
+  nee->t_max = 0.f;
+  if (num_lights > 0 && !last) {
+    int l = std::min((int)(sample_1d(sampler) * num_lights), num_lights - 1);
+    int light_id = world.lights[l];
+    const cl_float4 &light = world.sphere_geometry[light_id];
+    ray shadow_ray;
+    shadow_ray.origin = origin;
+    float u[2];
+    sample_2d(sampler, u);
+    float light_pdf = sample_sphere_cone(light, origin, &shadow_ray.dir, u)
+      / num_lights;
+    float cos_light = dot(shadow_ray.dir, normal_facing);
+    float t_light = light_pdf > 0.f && cos_light > 0.f
+      ? intersect_sphere(light, shadow_ray) : 0.f;
+    if (t_light > 0.f) {
+      float bsdf_pdf = cos_light / PI;
+      nee->shadow_ray = shadow_ray;
+      nee->t_max = t_light - EPSILON;
+      nee->radiance = *mask * color
+        * to_vec3(world.sphere_materials[light_id].emission) * cos_light
+        * bsdf_pdf / light_pdf * power_heuristic(light_pdf, bsdf_pdf);
+    }
+  }
+
+  float rands[2];
+  sample_2d(sampler, rands);
+  float rand1 = 2.f * PI * rands[0];
+  float rand2 = rands[1];
+  float rand2s = std::sqrt(rand2);
+  vec3 w = normal_facing, u, v;
+  make_frame(w, &u, &v);
+  vec3 newdir = normalize(u * std::cos(rand1) * rand2s
+      + v * std::sin(rand1) * rand2s + w * std::sqrt(1.f - rand2));
+
+  r->origin = origin;
+  r->dir = newdir;
+  *mask = *mask * color;
+  *mask = *mask * dot(newdir, normal_facing);
+  *pdf = dot(newdir, normal_facing) / PI;
+  return mask->x > 0.f || mask->y > 0.f || mask->z > 0.f;
+}
+
+static float luminance(const vec3 &c) {
+  return dot(c, { 0.2126f, 0.7152f, 0.0722f });
+}
+
+// trace() of the kernel for the `lanes` pixels of a row starting at `x`:
+// adds one sample to each of `sums` and its squared luminance to `sums_l2`,
+// and the rays it took to `rays`
+static void trace_packet(const scene &world, int num_lights, int bounces
+    , int x, int y, int lanes, int width, int height, path_sampler *samplers
+    , vec3 *sums, float *sums_l2, unsigned long long int *rays) {
+  ray_packet p = {};
+  vec3 mask[SIMD_WIDTH], radiance[SIMD_WIDTH];
+  float pdf[SIMD_WIDTH];
+  for (int i = 0; i < lanes; i++) {
+    float jitter[2];
+    sample_2d(&samplers[i], jitter);
+    p.set(i, create_cam_ray(x + i, y, width, height
+          , to_vec3(world.cam_position), jitter));
+    p.active[i] = -1;
+    mask[i] = { 1.f, 1.f, 1.f };
+    radiance[i] = { 0.f, 0.f, 0.f };
+    pdf[i] = 0.f;
+  }
+
+  for (int bounce = 0; bounce < bounces && any(p.active); bounce++) {
+    *rays += count(p.active);
+    intersect_scene(world, &p);
+
+    ray_packet shadow = {};
+    light_sample nee[SIMD_WIDTH];
+    for (int i = 0; i < lanes; i++) {
+      nee[i].t_max = 0.f;
+      if (!p.active[i])
+        continue;
+      if (!(p.t[i] < inf)) {
+        radiance[i] += mask[i] * background();
+        p.active[i] = 0;
+        continue;
+      }
+      ray r = p.get(i);
+      if (!diffuse_bounce(world, num_lights, p.hit_id[i], p.t[i]
+            , bounce == bounces - 1, &r, &mask[i], &pdf[i], &radiance[i]
+            , &samplers[i], &nee[i]))
+        p.active[i] = 0;
+      p.set(i, r);
+      if (nee[i].t_max > 0.f) {
+        shadow.set(i, nee[i].shadow_ray);
+        shadow.t[i] = nee[i].t_max;
+        shadow.active[i] = -1;
+      }
+    }
+
+    if (any(shadow.active)) {
+      *rays += count(shadow.active);
+      vint blocked = occluded(world, &shadow);
+      for (int i = 0; i < lanes; i++)
+        if (nee[i].t_max > 0.f && !blocked[i])
+          radiance[i] += nee[i].radiance;
+    }
+  }
+
+  for (int i = 0; i < lanes; i++) {
+    sums[i] += radiance[i];
+    sums_l2[i] += luminance(radiance[i]) * luminance(radiance[i]);
+  }
+}
+
+static float linear_to_srgb(float x) {
+  if (x < 0.0031308f)
+    x *= 12.92f;
+  else
+    x = 1.055f * std::pow(x, 1.f / 2.4f) - 0.055f;
+  return x;
+}
+
+// linear_to_srgb_clamp4 and convert_uchar4_sat_rte in one
+static uint8_t to_srgb8(float x) {
+  float c = std::nearbyint(linear_to_srgb(clamp(x, 0.f, 1.f)) * 255.f);
+  return (uint8_t)clamp(c, 0.f, 255.f);
+}
+
+// aov_kernel for the `lanes` pixels of a row starting at `x`
+static void trace_aovs(const scene &world, int x, int y, int lanes, int width
+    , int height, cl_float4 *albedo, cl_float4 *normal_depth) {
+  ray_packet p = {};
+  const float centre[2] = { 0.5f, 0.5f };
+  for (int i = 0; i < lanes; i++) {
+    p.set(i, create_cam_ray(x + i, y, width, height
+          , to_vec3(world.cam_position), centre));
+    p.active[i] = -1;
+  }
+  intersect_scene(world, &p);
+  for (int i = 0; i < lanes; i++) {
+    cl_float4 &a = albedo[i], &nd = normal_depth[i];
+    memset(&a, 0, sizeof(a));
+    memset(&nd, 0, sizeof(nd));
+    if (!(p.t[i] < inf))
+      continue;
+    ray r = p.get(i);
+    vec3 normal, color, emission;
+    surface_at(world, p.hit_id[i], r.origin + r.dir * p.t[i], &normal, &color
+        , &emission);
+    if (dot(normal, r.dir) >= 0.f)
+      normal = normal * (-1.f);
+    a = {{ color.x, color.y, color.z, 0.f }};
+    nd = {{ normal.x, normal.y, normal.z, p.t[i] }};
+  }
+}
+
+static vec3 demodulation(const cl_float4 &albedo) {
+  return { albedo.s[0] > 0.f ? albedo.s[0] : 1.f
+    , albedo.s[1] > 0.f ? albedo.s[1] : 1.f
+    , albedo.s[2] > 0.f ? albedo.s[2] : 1.f };
+}
+
+// of the whole image, region being all of it
+static float depth_slope(const cl_float4 *normal_depth, int x, int y
+    , int width, int height) {
+  float depth = normal_depth[y * width + x].s[3];
+  float left = normal_depth[y * width + std::max(x - 1, 0)].s[3]
+    , right = normal_depth[y * width + std::min(x + 1, width - 1)].s[3]
+    , down = normal_depth[std::max(y - 1, 0) * width + x].s[3]
+    , up = normal_depth[std::min(y + 1, height - 1) * width + x].s[3];
+  return std::max(std::min(std::fabs(left - depth), std::fabs(right - depth))
+      , std::min(std::fabs(down - depth), std::fabs(up - depth)));
+}
+
+static float geometry_weight(const cl_float4 &normal_depth_p
+    , const cl_float4 &normal_depth_q, float slope, float distance) {
+  float w_normal = std::max(dot(to_vec3(normal_depth_p)
+        , to_vec3(normal_depth_q)), 0.f);
+  for (int i = 0; i < 7; i++)
+    w_normal *= w_normal;
+  float w_depth = std::exp(-std::fabs(normal_depth_p.s[3]
+        - normal_depth_q.s[3]) / (slope * distance + 1e-3f));
+  return w_normal * w_depth;
+}
+
+// denoise_input_kernel for pixel (x, y)
+static cl_float4 denoise_input(const cl_float4 *accum, const float *moments
+    , const cl_float4 *albedo, const cl_float4 *normal_depth, int x_coord
+    , int y_coord, int width, int height) {
+  int pixel = y_coord * width + x_coord;
+  const cl_float4 &acc = accum[pixel];
+  float n = acc.s[3];
+  if (n <= 0.f)
+    return {{ 0.f, 0.f, 0.f, 0.f }};
+  float l = luminance(to_vec3(acc)) / n, l2 = moments[pixel] / n;
+  if (n < 4.f) {
+    const cl_float4 &nd = normal_depth[pixel];
+    float slope = depth_slope(normal_depth, x_coord, y_coord, width, height);
+    float weight_sum = 1.f;
+    for (int dy = -3; dy <= 3; dy++)
+      for (int dx = -3; dx <= 3; dx++) {
+        int x = x_coord + dx, y = y_coord + dy;
+        if ((dx == 0 && dy == 0) || x < 0 || x >= width || y < 0
+            || y >= height)
+          continue;
+        int q = y * width + x;
+        const cl_float4 &acc_q = accum[q];
+        if (acc_q.s[3] <= 0.f)
+          continue;
+        float w = geometry_weight(nd, normal_depth[q], slope
+            , std::sqrt((float)(dx * dx + dy * dy)));
+        l += w * luminance(to_vec3(acc_q)) / acc_q.s[3];
+        l2 += w * moments[q] / acc_q.s[3];
+        weight_sum += w;
+      }
+    l /= weight_sum;
+    l2 /= weight_sum;
+  }
+  vec3 demodulate = demodulation(albedo[pixel]);
+  float l_demodulate = luminance(demodulate);
+  float variance = std::max(l2 - l * l, 0.f) / n
+    / (l_demodulate * l_demodulate);
+  return {{ acc.s[0] / n / demodulate.x, acc.s[1] / n / demodulate.y
+    , acc.s[2] / n / demodulate.z, variance }};
+}
+
+// atrous_kernel for pixel (x, y), which returns what goes into `filtered`
+static cl_float4 atrous(const cl_float4 *in, const cl_float4 *albedo
+    , const cl_float4 *normal_depth, int x_coord, int y_coord, int width
+    , int height, int step, bool last) {
+  static const float kernel_weights[3] = { 3.f / 8.f, 1.f / 4.f, 1.f / 16.f };
+  int pixel = y_coord * width + x_coord;
+
+  float variance = 0.f, variance_weights = 0.f;
+  for (int dy = -1; dy <= 1; dy++)
+    for (int dx = -1; dx <= 1; dx++) {
+      int x = x_coord + dx, y = y_coord + dy;
+      if (x < 0 || x >= width || y < 0 || y >= height)
+        continue;
+      float w = (dx == 0 ? 2.f : 1.f) * (dy == 0 ? 2.f : 1.f);
+      variance += w * in[y * width + x].s[3];
+      variance_weights += w;
+    }
+  float sigma_l = 4.f * std::sqrt(variance / variance_weights) + 1e-6f;
+
+  const cl_float4 &c = in[pixel], &nd = normal_depth[pixel];
+  float l = luminance(to_vec3(c));
+  float slope = depth_slope(normal_depth, x_coord, y_coord, width, height);
+  float w_centre = kernel_weights[0] * kernel_weights[0];
+  vec3 sum = to_vec3(c) * w_centre;
+  float variance_sum = w_centre * w_centre * c.s[3], weight_sum = w_centre;
+  for (int dy = -2; dy <= 2; dy++)
+    for (int dx = -2; dx <= 2; dx++) {
+      int x = x_coord + dx * step, y = y_coord + dy * step;
+      if ((dx == 0 && dy == 0) || x < 0 || x >= width || y < 0
+          || y >= height)
+        continue;
+      int q = y * width + x;
+      const cl_float4 &c_q = in[q];
+      float w = kernel_weights[std::abs(dx)] * kernel_weights[std::abs(dy)]
+        * geometry_weight(nd, normal_depth[q], slope
+            , step * std::sqrt((float)(dx * dx + dy * dy)))
+        * std::exp(-std::fabs(l - luminance(to_vec3(c_q))) / sigma_l);
+      sum += to_vec3(c_q) * w;
+      variance_sum += w * w * c_q.s[3];
+      weight_sum += w;
+    }
+
+  vec3 color = sum / weight_sum;
+  if (!last)
+    return {{ color.x, color.y, color.z
+      , variance_sum / (weight_sum * weight_sum) }};
+  vec3 radiance = color * demodulation(albedo[pixel]);
+  return {{ radiance.x, radiance.y, radiance.z, 1.f }};
+}
+
+// NO_HIT
+static const int no_hit = 0x7fffffff;
+
+// project_to_screen
+static void project_to_screen(const vec3 &p, const vec3 &cam_pos
+    , const cl_int4 &view, float screen[2]) {
+  vec3 on_screen = cam_pos + (p - cam_pos) * (cam_pos.z / (cam_pos.z - p.z));
+  float aspect_ratio = (float)view.s[2] / (float)view.s[3];
+  screen[0] = (on_screen.x / aspect_ratio + 0.5f) * (float)view.s[2]
+    - (float)view.s[0];
+  screen[1] = (on_screen.y + 0.5f) * (float)view.s[3] - (float)view.s[1];
+}
+
+cpu_renderer::cpu_renderer(int width, int height, int threads)
+  : _pool(threads)
+  , _arenas(_pool.size())
+  , _thread_rays(_pool.size(), 0)
+  , _width(width)
+  , _height(height)
+  , _view({{ 0, 0, width, height }})
+  , _tiles_x((width + tile_size - 1) / tile_size)
+  , _tiles_y((height + tile_size - 1) / tile_size)
+  , _accum((size_t)width * height)
+  , _moments((size_t)width * height, 0.f)
+  , _rgba8((size_t)width * height * 4, 0)
+  , _last_scene(nullptr)
+  , _last_version(0)
+  , _last_bounces(-1)
+  , _frame(0)
+  , _samples(0)
+  , _nee(true)
+  , _sampler(sampler_type::blue_noise)
+  , _denoise(false)
+  , _aovs_valid(false)
+  , _temporal(false)
+  , _history_valid(false)
+  , _sequence(0)
+  , _adaptive_threshold(0.f)
+  , _profiler(nullptr) {
+  memset(_accum.data(), 0, _accum.size() * sizeof(cl_float4));
+}
+
+void cpu_renderer::render(const scene &world, int samples, int bounces) {
+  bool reset = _last_scene != &world || _last_version != world.version
+    || memcmp(&_last_cam_position, &world.cam_position
+        , sizeof(world.cam_position)) != 0
+    || _last_bounces != bounces
+    || memcmp(&_last_view, &_view, sizeof(_view)) != 0;
+  // see cl_renderer::enqueue()
+  bool history = false;
+  cl_float3 previous_cam_position = _last_cam_position;
+  if (reset) {
+    history = _temporal && _last_scene == &world && _last_bounces == bounces
+      && memcmp(&_last_view, &_view, sizeof(_view)) == 0
+      && world.get_changes(_last_version, &_changed_spheres
+          , &_changed_sphere_nodes);
+    _last_scene = &world;
+    _last_version = world.version;
+    _last_cam_position = world.cam_position;
+    _last_bounces = bounces;
+    _last_view = _view;
+    _samples = 0;
+  }
+  bool clear = reset;
+  if (reset && _temporal) {
+    profile_scope scope(_profiler, "reproject");
+    _reproject(world, history, previous_cam_position);
+    clear = false;
+  }
+
+  int tile_samples = samples, spent_samples = samples;
+  if (_adaptive_threshold > 0.f && !reset && _samples >= adaptive_warmup_spp
+      && samples > 0) {
+    profile_scope scope(_profiler, "tile error");
+    _select_tiles(samples, &tile_samples, &spent_samples);
+  } else {
+    _tile_list.resize(_tiles_x * _tiles_y);
+    for (int i = 0; i < _tiles_x * _tiles_y; i++)
+      _tile_list[i] = i;
+  }
+
+  {
+    profile_scope scope(_profiler, "render tiles");
+    _pool.run((int)_tile_list.size(), [&](int task, int thread) {
+          _render_tile(world, _tile_list[task], thread, tile_samples, bounces
+              , clear);
+        });
+  }
+  if (_denoise) {
+    profile_scope scope(_profiler, "denoise");
+    _denoise_image(world, reset);
+  }
+  ++_frame;
+  _samples += spent_samples;
+}
+
+// like cl_renderer::_select_tiles over the whole image
+void cpu_renderer::_select_tiles(int samples, int *tile_samples
+    , int *spent_samples) {
+  int region_tiles = _tiles_x * _tiles_y;
+  _tile_list.clear();
+  for (int tile = 0; tile < region_tiles; tile++)
+    if (_tile_error(tile) > _adaptive_threshold)
+      _tile_list.push_back(tile);
+  int active = (int)_tile_list.size();
+  if (active == 0) {
+    // converged, nothing left to do
+    *spent_samples = 0;
+    return;
+  }
+  *tile_samples = std::min(samples * region_tiles / active
+      , samples * adaptive_max_boost);
+  *spent_samples = std::max(1, *tile_samples * active / region_tiles);
+}
+
+// tile_error_kernel
+float cpu_renderer::_tile_error(int tile) {
+  int x0 = tile % _tiles_x * tile_size, y0 = tile / _tiles_x * tile_size
+    , x1 = std::min(x0 + tile_size, _width)
+    , y1 = std::min(y0 + tile_size, _height);
+  float error = 0.f;
+  int pixels = 0;
+  for (int y = y0; y < y1; y++)
+    for (int x = x0; x < x1; x++) {
+      int pixel = y * _width + x;
+      const cl_float4 &acc = _accum[pixel];
+      float n = acc.s[3];
+      if (n < 2.f) {
+        error = inf;
+        continue;
+      }
+      float mean = luminance(to_vec3(acc)) / n;
+      float variance = std::max(_moments[pixel] / n - mean * mean, 0.f)
+        * n / (n - 1.f);
+      float std_error = std::sqrt(variance / n);
+      error += mean - 2.f * std_error > 1.f ? 0.f
+        : std_error / (mean + 0.05f);
+      ++pixels;
+    }
+  return pixels > 0 && error < inf ? error / pixels : error;
+}
+
+// render_kernel for the pixels of one tile, a packet of neighbouring pixels
+// in a row at a time
+void cpu_renderer::_render_tile(const scene &world, int tile, int thread
+    , int samples, int bounces, bool reset) {
+  int x0 = tile % _tiles_x * tile_size, y0 = tile / _tiles_x * tile_size
+    , x1 = std::min(x0 + tile_size, _width)
+    , y1 = std::min(y0 + tile_size, _height);
+  int tile_width = x1 - x0, pixels = tile_width * (y1 - y0);
+  arena &scratch = _arenas[thread];
+  scratch.reset();
+  path_sampler *samplers = scratch.alloc<path_sampler>(pixels);
+  uint32_t *first_samples = scratch.alloc<uint32_t>(pixels);
+  vec3 *sums = scratch.alloc<vec3>(pixels);
+  float *sums_l2 = scratch.alloc<float>(pixels);
+  for (int y = y0; y < y1; y++)
+    for (int x = x0; x < x1; x++) {
+      int i = (y - y0) * tile_width + x - x0;
+      samplers[i] = make_sampler(_sampler, x + _view.s[0], y + _view.s[1]
+          , _view.s[2], _frame, _sequence);
+      first_samples[i] = reset ? 0 : (uint32_t)_accum[y * _width + x].s[3];
+      sums[i] = { 0.f, 0.f, 0.f };
+      sums_l2[i] = 0.f;
+    }
+
+  int num_lights = _nee ? (int)world.lights.size() : 0;
+  unsigned long long int rays = 0;
+  for (int y = y0; y < y1; y++)
+    for (int x = x0; x < x1; x += SIMD_WIDTH) {
+      int i = (y - y0) * tile_width + x - x0;
+      int lanes = std::min(SIMD_WIDTH, x1 - x);
+      for (int sample = 0; sample < samples; sample++) {
+        for (int lane = 0; lane < lanes; lane++)
+          start_sample(&samplers[i + lane], first_samples[i + lane] + sample);
+        trace_packet(world, num_lights, bounces, x + _view.s[0]
+            , y + _view.s[1], lanes, _view.s[2], _view.s[3], &samplers[i]
+            , &sums[i], &sums_l2[i], &rays);
+      }
+    }
+  _thread_rays[thread] += rays;
+
+  for (int y = y0; y < y1; y++)
+    for (int x = x0; x < x1; x++) {
+      int i = (y - y0) * tile_width + x - x0, pixel = y * _width + x;
+      cl_float4 &acc = _accum[pixel];
+      if (reset)
+        memset(&acc, 0, sizeof(acc));
+      acc.s[0] += sums[i].x;
+      acc.s[1] += sums[i].y;
+      acc.s[2] += sums[i].z;
+      acc.s[3] += (float)samples;
+      _moments[pixel] = (reset ? 0.f : _moments[pixel]) + sums_l2[i];
+      for (int c = 0; c < 3; c++)
+        _rgba8[pixel * 4 + c] = to_srgb8(acc.s[3] > 0.f
+            ? acc.s[c] / acc.s[3] : acc.s[c]);
+      _rgba8[pixel * 4 + 3] = 255;
+    }
+}
+
+// what cl_renderer::_enqueue_reproject() queues, reproject_kernel a packet
+// of a row at a time
+void cpu_renderer::_reproject(const scene &world, bool history
+    , const cl_float3 &previous_cam_position) {
+  size_t pixels = (size_t)_width * _height;
+  if (_hit_ids.empty()) {
+    _history_accum.resize(pixels);
+    _history_moments.resize(pixels);
+    for (std::vector<int> *ids : { &_hit_ids, &_history_ids })
+      ids->resize(pixels);
+    for (std::vector<float> *depths : { &_hit_depths, &_history_depths })
+      depths->resize(pixels);
+  }
+  std::swap(_accum, _history_accum);
+  std::swap(_moments, _history_moments);
+  std::swap(_hit_ids, _history_ids);
+  std::swap(_hit_depths, _history_depths);
+  history = history && _history_valid
+    && _previous_spheres.size() == world.sphere_geometry.size();
+
+  vec3 cam_pos = to_vec3(world.cam_position)
+    , previous_cam_pos = to_vec3(previous_cam_position);
+  _pool.run(_tiles_x * _tiles_y, [&](int tile, int thread) {
+        int x0 = tile % _tiles_x * tile_size, y0 = tile / _tiles_x * tile_size
+          , x1 = std::min(x0 + tile_size, _width)
+          , y1 = std::min(y0 + tile_size, _height);
+        const float centre[2] = { 0.5f, 0.5f };
+        for (int y = y0; y < y1; y++)
+          for (int x = x0; x < x1; x += SIMD_WIDTH) {
+            int lanes = std::min(SIMD_WIDTH, x1 - x);
+            ray_packet p = {};
+            for (int i = 0; i < lanes; i++) {
+              p.set(i, create_cam_ray(x + i + _view.s[0], y + _view.s[1]
+                    , _view.s[2], _view.s[3], cam_pos, centre));
+              p.active[i] = -1;
+            }
+            intersect_scene(world, &p);
+            _thread_rays[thread] += lanes;
+            for (int i = 0; i < lanes; i++) {
+              int pixel = y * _width + x + i, hit_id = no_hit;
+              float previous[2] = { (float)(x + i) + 0.5f, (float)y + 0.5f };
+              float depth = 0.f, previous_depth = 0.f;
+              if (p.t[i] < inf) {
+                ray r = p.get(i);
+                vec3 point = r.origin + r.dir * p.t[i];
+                hit_id = p.hit_id[i];
+                if (history && hit_id >= 0)
+                  point += to_vec3(_previous_spheres[hit_id])
+                    - to_vec3(world.sphere_geometry[hit_id]);
+                depth = p.t[i];
+                vec3 d = point - previous_cam_pos;
+                previous_depth = std::sqrt(dot(d, d));
+                if (point.z < previous_cam_pos.z)
+                  project_to_screen(point, previous_cam_pos, _view, previous);
+                else
+                  previous[0] = previous[1] = -1.f;
+              }
+              _hit_ids[pixel] = hit_id;
+              _hit_depths[pixel] = depth;
+
+              cl_float4 &acc = _accum[pixel];
+              memset(&acc, 0, sizeof(acc));
+              _moments[pixel] = 0.f;
+              if (!history || !(previous[0] >= 0.f
+                    && previous[0] < (float)_width && previous[1] >= 0.f
+                    && previous[1] < (float)_height))
+                continue;
+              int q = (int)previous[1] * _width + (int)previous[0];
+              if (_history_ids[q] != hit_id || std::fabs(_history_depths[q]
+                    - previous_depth) > 0.05f * previous_depth)
+                continue;
+              acc = _history_accum[q];
+              _moments[pixel] = _history_moments[q];
+              if (acc.s[3] > (float)temporal_max_spp) {
+                float scale = (float)temporal_max_spp / acc.s[3];
+                for (int c = 0; c < 4; c++)
+                  acc.s[c] *= scale;
+                _moments[pixel] *= scale;
+              }
+            }
+          }
+      });
+  _previous_spheres = world.sphere_geometry;
+  _history_valid = true;
+  ++_sequence;
+}
+
+// what cl_renderer::_enqueue_denoise() queues, a tile at a time
+void cpu_renderer::_denoise_image(const scene &world, bool reset) {
+  size_t pixels = (size_t)_width * _height;
+  if (_albedo.empty()) {
+    _albedo.resize(pixels);
+    _normal_depth.resize(pixels);
+    for (std::vector<cl_float4> &image : _denoised)
+      image.resize(pixels);
+  }
+  // calls f(x0, y0, x1, y1, thread) for every tile on the pool
+  auto for_each_tile = [&](const auto &f) {
+    _pool.run(_tiles_x * _tiles_y, [&](int tile, int thread) {
+          int x0 = tile % _tiles_x * tile_size
+            , y0 = tile / _tiles_x * tile_size;
+          f(x0, y0, std::min(x0 + tile_size, _width)
+              , std::min(y0 + tile_size, _height), thread);
+        });
+  };
+
+  if (reset || !_aovs_valid) {
+    for_each_tile([&](int x0, int y0, int x1, int y1, int thread) {
+          for (int y = y0; y < y1; y++)
+            for (int x = x0; x < x1; x += SIMD_WIDTH) {
+              int lanes = std::min(SIMD_WIDTH, x1 - x);
+              trace_aovs(world, x + _view.s[0], y + _view.s[1], lanes
+                  , _view.s[2], _view.s[3], &_albedo[y * _width + x]
+                  , &_normal_depth[y * _width + x]);
+              _thread_rays[thread] += lanes;
+            }
+        });
+    _aovs_valid = true;
+  }
+
+  for_each_tile([&](int x0, int y0, int x1, int y1, int) {
+        for (int y = y0; y < y1; y++)
+          for (int x = x0; x < x1; x++)
+            _denoised[0][y * _width + x] = denoise_input(_accum.data()
+                , _moments.data(), _albedo.data(), _normal_depth.data(), x, y
+                , _width, _height);
+      });
+  for (int pass = 0; pass < denoise_passes; pass++) {
+    bool last = pass == denoise_passes - 1;
+    const cl_float4 *in = _denoised[pass & 1].data();
+    cl_float4 *filtered = _denoised[(pass + 1) & 1].data();
+    for_each_tile([&](int x0, int y0, int x1, int y1, int) {
+          for (int y = y0; y < y1; y++)
+            for (int x = x0; x < x1; x++) {
+              int pixel = y * _width + x;
+              filtered[pixel] = atrous(in, _albedo.data()
+                  , _normal_depth.data(), x, y, _width, _height, 1 << pass
+                  , last);
+              if (last)
+                for (int c = 0; c < 3; c++)
+                  _rgba8[pixel * 4 + c] = to_srgb8(filtered[pixel].s[c]);
+            }
+        });
+  }
+}
+
+void cpu_renderer::read_rgba8(std::vector<uint8_t> *rgba) {
+  *rgba = _rgba8;
+}
+
+void cpu_renderer::read_radiance(std::vector<float> *rgba) {
+  rgba->resize((size_t)_width * _height * 4);
+  // the last filter pass leaves the radiance in _denoised
+  if (_denoise && _aovs_valid) {
+    memcpy(rgba->data(), _denoised[denoise_passes & 1].data()
+        , rgba->size() * sizeof(float));
+    return;
+  }
+  memcpy(rgba->data(), _accum.data(), rgba->size() * sizeof(float));
+  resolve_accum(rgba->data(), (size_t)_width * _height);
+}
+
+unsigned long long int cpu_renderer::get_accumulated_samples() {
+  return _samples;
+}
+
+void cpu_renderer::set_wavefront(bool) {
+}
+
+void cpu_renderer::set_adaptive(float threshold) {
+  _adaptive_threshold = threshold;
+}
+
+void cpu_renderer::set_nee(bool nee) {
+  _nee = nee;
+}
+
+void cpu_renderer::set_sampler(sampler_type sampler) {
+  _sampler = sampler;
+}
+
+void cpu_renderer::set_denoise(bool denoise) {
+  _denoise = denoise;
+  _aovs_valid = false;
+}
+
+void cpu_renderer::set_view(int x, int y, int full_width, int full_height) {
+  _view = {{ x, y, full_width, full_height }};
+}
+
+void cpu_renderer::set_temporal(bool temporal) {
+  _temporal = temporal;
+  _history_valid = false;
+}
+
+// rays are always counted, it costs next to nothing here
+void cpu_renderer::set_count_rays(bool) {
+  std::fill(_thread_rays.begin(), _thread_rays.end(), 0);
+}
+
+unsigned long long int cpu_renderer::get_ray_count() {
+  unsigned long long int rays = 0;
+  for (unsigned long long int r : _thread_rays)
+    rays += r;
+  return rays;
+}
+
+std::string cpu_renderer::get_name() {
+  return "native, " + std::to_string(_pool.size()) + " threads, "
+    + std::to_string(SIMD_WIDTH) + " rays per packet";
+}
+
+void cpu_renderer::set_specialise(bool, bool) {
+}
+
+void cpu_renderer::set_profiler(frame_profiler *profiler) {
+  _profiler = profiler;
+}
+
+int cpu_renderer::get_threads() {
+  return _pool.size();
+}
+
+int cpu_renderer::get_packet_width() {
+  return SIMD_WIDTH;
+}
+
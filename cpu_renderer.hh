@@ -0,0 +1,86 @@
+#pragma once
+
+#include "renderer.hh"
+#include "thread_pool.hh"
+#include "arena.hh"
+
+// the path tracer of opencl_kernel.cl on the host's cores, for machines
+// without an OpenCL runtime. tiles of the image are spread over a
+// work-stealing thread pool, and paths are traced in packets of SIMD_WIDTH
+// neighbouring pixels whose intersection tests run in sse or avx lanes. it
+// takes the same scene and random sequences as the kernel and renders the
+// same image
+class cpu_renderer : public renderer {
+  thread_pool _pool;
+  // scratch memory of the tile a thread works on, one arena per thread
+  std::vector<arena> _arenas;
+  // rays traced by each thread
+  std::vector<unsigned long long int> _thread_rays;
+  int _width, _height;
+  // see set_view()
+  cl_int4 _view;
+  int _tiles_x, _tiles_y;
+  std::vector<cl_float4> _accum;
+  std::vector<float> _moments;
+  std::vector<uint8_t> _rgba8;
+  const scene *_last_scene;
+  unsigned long long int _last_version;
+  cl_float3 _last_cam_position;
+  int _last_bounces;
+  cl_int4 _last_view;
+  unsigned int _frame;
+  unsigned long long int _samples;
+  bool _nee;
+  sampler_type _sampler;
+  // the denoiser's images, allocated on first use: what pixels see first,
+  // traced again on reset, and the image between filter passes
+  bool _denoise;
+  std::vector<cl_float4> _albedo, _normal_depth, _denoised[2];
+  bool _aovs_valid;
+  // temporal reuse, see cl_renderer: the accumulation and first hits of the
+  // render before, allocated on first use, and where the spheres were
+  bool _temporal;
+  std::vector<cl_float4> _history_accum, _previous_spheres;
+  std::vector<float> _history_moments, _hit_depths, _history_depths;
+  std::vector<int> _hit_ids, _history_ids;
+  bool _history_valid;
+  unsigned int _sequence;
+  // reused for the indices of changed spheres and nodes
+  std::vector<int> _changed_spheres, _changed_sphere_nodes;
+  float _adaptive_threshold;
+  std::vector<int> _tile_list;
+  frame_profiler *_profiler;
+
+  void _select_tiles(int samples, int *tile_samples, int *spent_samples);
+  float _tile_error(int tile);
+  void _render_tile(const scene &world, int tile, int thread, int samples
+      , int bounces, bool reset);
+  void _reproject(const scene &world, bool history
+      , const cl_float3 &previous_cam_position);
+  void _denoise_image(const scene &world, bool reset);
+public:
+  // 0 threads is one per hardware thread
+  cpu_renderer(int width, int height, int threads);
+  void render(const scene &world, int samples, int bounces);
+  void read_rgba8(std::vector<uint8_t> *rgba);
+  void read_radiance(std::vector<float> *rgba);
+  unsigned long long int get_accumulated_samples();
+  // paths are always traced in packets, there is no wavefront mode
+  void set_wavefront(bool wavefront);
+  void set_adaptive(float threshold);
+  void set_nee(bool nee);
+  void set_count_rays(bool count);
+  void set_sampler(sampler_type sampler);
+  void set_denoise(bool denoise);
+  void set_temporal(bool temporal);
+  void set_view(int x, int y, int full_width, int full_height);
+  void set_specialise(bool specialise, bool wait);
+  unsigned long long int get_ray_count();
+  std::string get_name();
+  // there are no commands to time, only the stages on the calling thread
+  void set_profiler(frame_profiler *profiler);
+  int get_threads();
+  // rays per packet, SIMD_WIDTH
+  int get_packet_width();
+};
+
@@ -0,0 +1,127 @@
+#include "frame_budget.hh"
+#include <algorithm>
+
+// weight of the newest frame time in the running average
+static const double smoothing = 0.2;
+// the band frame times are left alone in, relative to the target
+static const double too_slow = 1.1, spare = 0.75;
+// where changes aim the frame time at, inside the band
+static const double aim = 0.9;
+// frames in a row out of the band before the levels change
+static const int hold_frames = 10;
+// fewer bounces hardly light the scene
+static const int min_bounces = 2;
+static const int max_scale = 4;
+
+// roughly what a frame takes: every sample of every pixel follows a path
+// of up to `bounces` segments
+static double cost(int samples, int bounces, int scale) {
+  return (double)std::max(samples, 1) * std::max(bounces, 1)
+    / ((double)scale * scale);
+}
+
+frame_budget::frame_budget(double target_ms, bool scale_resolution
+    , int samples, int bounces)
+  : _target_ms(target_ms)
+  , _scale_resolution(scale_resolution)
+  , _smoothed_ms(0.)
+  , _overhead_ms(0.)
+  , _last_ms(0.)
+  , _last_cost(0.)
+  , _over(0)
+  , _under(0)
+  , _samples(samples)
+  , _bounces(bounces)
+  , _scale(1) {
+}
+
+// what frames are expected to take at these levels
+double frame_budget::_predict(int samples, int bounces, int scale) const {
+  return _overhead_ms + (_smoothed_ms - _overhead_ms)
+    * cost(samples, bounces, scale) / cost(_samples, _bounces, _scale);
+}
+
+// frame times so far say little about the new levels, the average starts
+// over from what they are expected to take
+void frame_budget::_change(int samples, int bounces, int scale) {
+  _last_ms = _smoothed_ms;
+  _last_cost = cost(_samples, _bounces, _scale);
+  _smoothed_ms = _predict(samples, bounces, scale);
+  _samples = samples;
+  _bounces = bounces;
+  _scale = scale;
+  _over = _under = 0;
+}
+
+void frame_budget::update(double frame_ms, int max_samples
+    , int max_bounces) {
+  // the user turning quality down takes effect right away
+  if (_samples > max_samples || _bounces > max_bounces)
+    _change(std::min(_samples, max_samples), std::min(_bounces, max_bounces)
+        , _scale);
+  if (!(frame_ms > 0.))
+    return;
+  _smoothed_ms = _smoothed_ms > 0.
+    ? _smoothed_ms + smoothing * (frame_ms - _smoothed_ms) : frame_ms;
+  _over = _smoothed_ms > too_slow * _target_ms ? _over + 1 : 0;
+  _under = _smoothed_ms < spare * _target_ms ? _under + 1 : 0;
+  if (_over < hold_frames && _under < hold_frames)
+    return;
+
+  // the times before and since the last change are two points of the
+  // model's line, if their costs are far enough apart to tell
+  double now_cost = cost(_samples, _bounces, _scale);
+  if (_last_cost > 0. && (now_cost > 1.5 * _last_cost
+        || _last_cost > 1.5 * now_cost)) {
+    double per_cost = (_smoothed_ms - _last_ms) / (now_cost - _last_cost);
+    _overhead_ms = std::max(0., std::min(_smoothed_ms - per_cost * now_cost
+          , std::min(_smoothed_ms, _last_ms)));
+  }
+  // aiming at is what is left for the part that grows
+  double target = aim * _target_ms;
+  if (_over >= hold_frames) {
+    // fewest samples first, then as many bounces as fit
+    if (_samples > 1) {
+      int samples = _samples - 1;
+      while (samples > 1 && _predict(samples, _bounces, _scale) > target)
+        --samples;
+      _change(samples, _bounces, _scale);
+    } else if (_bounces > std::min(min_bounces, max_bounces)) {
+      int bounces = _bounces - 1;
+      while (bounces > min_bounces
+          && _predict(_samples, bounces, _scale) > target)
+        --bounces;
+      _change(_samples, bounces, _scale);
+    } else if (_scale_resolution && _scale < max_scale)
+      _change(_samples, _bounces, _scale * 2);
+  } else {
+    // only steps that are expected to fit are taken, which is what keeps
+    // the levels from going back and forth
+    if (_scale > 1) {
+      if (_predict(_samples, _bounces, _scale / 2) <= target)
+        _change(_samples, _bounces, _scale / 2);
+    } else if (_bounces < max_bounces) {
+      if (_predict(_samples, _bounces + 1, _scale) <= target)
+        _change(_samples, _bounces + 1, _scale);
+    } else if (_samples < max_samples) {
+      int samples = _samples;
+      while (samples < max_samples
+          && _predict(samples + 1, _bounces, _scale) <= target)
+        ++samples;
+      if (samples > _samples)
+        _change(samples, _bounces, _scale);
+    }
+  }
+}
+
+int frame_budget::get_samples() const {
+  return _samples;
+}
+
+int frame_budget::get_bounces() const {
+  return _bounces;
+}
+
+int frame_budget::get_scale() const {
+  return _scale;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+// holds the time of interactive frames near a target by trading quality for
+// speed: samples per frame go first, then bounces, then, if allowed, the
+// render resolution, and they come back in the opposite order. frame times
+// are modelled as a fixed part plus one that grows with the samples traced.
+// to keep the picture from flickering between levels, frame times are
+// smoothed, have to stay out of a band around the target for a number of
+// frames before anything changes, and a level only goes up if it is
+// expected to still fit with room to spare
+class frame_budget {
+  double _target_ms;
+  bool _scale_resolution;
+  // running average of frame times, 0 before the first
+  double _smoothed_ms;
+  // what frames take whatever the levels, estimated from how frame times
+  // changed with them, and the average and cost before the last change
+  double _overhead_ms, _last_ms, _last_cost;
+  // frames in a row that were too slow or had time to spare
+  int _over, _under;
+  int _samples, _bounces, _scale;
+
+  double _predict(int samples, int bounces, int scale) const;
+  void _change(int samples, int bounces, int scale);
+public:
+  // `scale_resolution` lets the resolution go down to a quarter of the
+  // window's in each direction
+  frame_budget(double target_ms, bool scale_resolution, int samples
+      , int bounces);
+  // takes the time of the last frame and picks the levels of the next. the
+  // user's samples and bounces are the most it picks
+  void update(double frame_ms, int max_samples, int max_bounces);
+  int get_samples() const;
+  int get_bounces() const;
+  // the render resolution is the window's divided by this
+  int get_scale() const;
+};
@@ -0,0 +1,243 @@
+#include "frame_writer.hh"
+#include "image.hh"
+#include "utils.hh"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <unistd.h>
+
+spsc_queue::spsc_queue(size_t capacity)
+  : _items(capacity)
+  , _head(0)
+  , _tail(0) {
+}
+
+bool spsc_queue::push(int item) {
+  size_t tail = _tail.load(std::memory_order_relaxed);
+  if (tail - _head.load(std::memory_order_acquire) == _items.size())
+    return false;
+  _items[tail % _items.size()] = item;
+  _tail.store(tail + 1, std::memory_order_release);
+  return true;
+}
+
+bool spsc_queue::pop(int *item) {
+  size_t head = _head.load(std::memory_order_relaxed);
+  if (head == _tail.load(std::memory_order_acquire))
+    return false;
+  *item = _items[head % _items.size()];
+  _head.store(head + 1, std::memory_order_release);
+  return true;
+}
+
+size_t spsc_queue::size() const {
+  return _tail.load(std::memory_order_acquire)
+    - _head.load(std::memory_order_acquire);
+}
+
+static bool ends_with(const std::string &s, const char *suffix) {
+  std::string end(suffix);
+  return s.size() >= end.size()
+    && s.compare(s.size() - end.size(), end.size(), end) == 0;
+}
+
+frame_writer::frame_writer(const std::string &path, int width, int height
+    , int fps, int buffers)
+  : _format(path == "-" || ends_with(path, ".y4m") ? format::y4m
+      : image_wants_float(path) ? format::pfm : format::ppm)
+  , _number_width(0)
+  , _number_zeros(false)
+  , _width(width)
+  , _height(height)
+  , _stream(nullptr)
+  , _buffers(buffers)
+  , _free(buffers)
+  , _full(buffers)
+  , _filling(-1)
+  , _frames(0)
+  , _dropped(0)
+  , _written(0)
+  , _quit(false) {
+  if (_format != format::y4m)
+    _parse_name(path);
+  if (_format != format::y4m && !ends_with(path, ".ppm")
+      && _format != format::pfm)
+    die("\"%s\" is neither .ppm, .pfm nor .y4m", path.c_str());
+  if (path == "-") {
+    // the stream keeps standard output to itself
+    fflush(stdout);
+    int fd = dup(STDOUT_FILENO);
+    assertf(fd >= 0 && dup2(STDERR_FILENO, STDOUT_FILENO) >= 0
+        , "failed to take over standard output");
+    _stream = fdopen(fd, "wb");
+  } else if (_format == format::y4m)
+    _stream = fopen(path.c_str(), "wb");
+  if (_format == format::y4m) {
+    assertf(_stream, "failed to open \"%s\" for writing", path.c_str());
+    // full frames with square pixels, BT.601 video levels
+    fprintf(_stream, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444 "
+        "XCOLORRANGE=LIMITED\n", width, height, fps);
+    _planes.resize((size_t)width * height * 3);
+  }
+  for (int i = 0; i < buffers; i++) {
+    if (_format == format::pfm)
+      _buffers[i].rgba.resize((size_t)width * height * 4);
+    else
+      _buffers[i].rgba8.resize((size_t)width * height * 4);
+    _free.push(i);
+  }
+  _thread = std::thread(&frame_writer::_run, this);
+}
+
+frame_writer::~frame_writer() {
+  _quit.store(true, std::memory_order_release);
+  _wake.notify_one();
+  _thread.join();
+  if (_stream)
+    fclose(_stream);
+}
+
+frame_writer::format frame_writer::get_format() const {
+  return _format;
+}
+
+void frame_writer::_run() {
+  for (;;) {
+    // quitting is only looked at before the queue, so that frames queued
+    // before it still get written
+    bool quit = _quit.load(std::memory_order_acquire);
+    int i;
+    if (_full.pop(&i)) {
+      _write(_buffers[i]);
+      _written.fetch_add(1, std::memory_order_relaxed);
+      _free.push(i);
+    } else if (quit)
+      break;
+    else {
+      // frames are queued without taking the lock, a wake up that comes
+      // between looking at the queue and waiting is caught by the timeout
+      std::unique_lock<std::mutex> lock(_mutex);
+      _wake.wait_for(lock, std::chrono::milliseconds(5));
+    }
+  }
+}
+
+// splits `path` around its one %[0][width]d, dies unless there is exactly
+// one. the path never goes to printf, so nothing else in it is taken for a
+// conversion
+void frame_writer::_parse_name(const std::string &path) {
+  std::string *part = &_name_prefix;
+  bool numbered = false;
+  for (size_t i = 0; i < path.size(); i++) {
+    if (path[i] != '%') {
+      *part += path[i];
+      continue;
+    }
+    if (i + 1 < path.size() && path[i + 1] == '%') {
+      *part += '%';
+      i++;
+      continue;
+    }
+    size_t j = i + 1;
+    bool zeros = j < path.size() && path[j] == '0';
+    if (zeros)
+      j++;
+    int width = 0;
+    while (j < path.size() && isdigit((unsigned char)path[j]) && width < 100)
+      width = width * 10 + (path[j++] - '0');
+    if (j >= path.size() || path[j] != 'd' || numbered)
+      die("\"%s\" needs exactly one frame number such as %%05d, and %%%% for "
+          "a literal %%", path.c_str());
+    numbered = true;
+    _number_zeros = zeros;
+    _number_width = width;
+    part = &_name_suffix;
+    i = j;
+  }
+  if (!numbered)
+    die("\"%s\" has no frame number, such as %%05d", path.c_str());
+}
+
+void frame_writer::_write(const buffer &b) {
+  if (_format == format::y4m) {
+    _write_y4m(b);
+    return;
+  }
+  std::string number = std::to_string(b.number);
+  if ((int)number.size() < _number_width)
+    number.insert(0, _number_width - number.size(), _number_zeros ? '0' : ' ');
+  std::string name = _name_prefix + number + _name_suffix;
+  if (_format == format::pfm)
+    write_pfm(name, b.width, b.height, b.rgba);
+  else
+    write_ppm(name, b.width, b.height, b.rgba8);
+}
+
+// 8-bit sRGB to BT.601 Y'CbCr at video levels, top row first
+void frame_writer::_write_y4m(const buffer &b) {
+  size_t plane = (size_t)_width * _height;
+  uint8_t *y_plane = _planes.data(), *cb_plane = y_plane + plane
+    , *cr_plane = cb_plane + plane;
+  for (int y = 0; y < _height; y++) {
+    const uint8_t *src = &b.rgba8[(size_t)(_height - 1 - y) * _width * 4];
+    size_t row = (size_t)y * _width;
+    for (int x = 0; x < _width; x++) {
+      float r = src[x * 4], g = src[x * 4 + 1], bl = src[x * 4 + 2]
+        , luma = 0.299f * r + 0.587f * g + 0.114f * bl;
+      y_plane[row + x] = (uint8_t)(16.5f + luma * (219.f / 255.f));
+      cb_plane[row + x] = (uint8_t)(128.5f
+          + (bl - luma) * (224.f / 255.f / 1.772f));
+      cr_plane[row + x] = (uint8_t)(128.5f
+          + (r - luma) * (224.f / 255.f / 1.402f));
+    }
+  }
+  fputs("FRAME\n", _stream);
+  fwrite(_planes.data(), 1, _planes.size(), _stream);
+  fflush(_stream);
+}
+
+void* frame_writer::begin_frame() {
+  assertf(_filling < 0, "the frame before has not ended");
+  if (!_free.pop(&_filling)) {
+    ++_dropped;
+    return nullptr;
+  }
+  buffer &b = _buffers[_filling];
+  return _format == format::pfm ? (void*)b.rgba.data()
+    : (void*)b.rgba8.data();
+}
+
+void frame_writer::end_frame(int width, int height) {
+  assertf(_filling >= 0, "no frame has begun");
+  assertf(width <= _width && height <= _height
+      && (_format != format::y4m || (width == _width && height == _height))
+      , "frame of %dx%d does not fit the recording", width, height);
+  buffer &b = _buffers[_filling];
+  b.width = width;
+  b.height = height;
+  b.number = _frames++;
+  // never full, there are only as many buffers as it holds
+  _full.push(_filling);
+  _filling = -1;
+  _wake.notify_one();
+}
+
+void frame_writer::drop_frame() {
+  ++_dropped;
+}
+
+unsigned long long int frame_writer::get_frames() const {
+  return _frames;
+}
+
+unsigned long long int frame_writer::get_written() const {
+  return _written.load(std::memory_order_relaxed);
+}
+
+unsigned long long int frame_writer::get_dropped() const {
+  return _dropped;
+}
+
+int frame_writer::get_queued() const {
+  return (int)_full.size();
+}
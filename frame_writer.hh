@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// queue of a bounded number of ints between one thread pushing and one
+// popping that neither locks nor allocates
+class spsc_queue {
+  std::vector<int> _items;
+  // counts of pops and pushes so far, each only written by its own thread
+  alignas(64) std::atomic<size_t> _head;
+  alignas(64) std::atomic<size_t> _tail;
+public:
+  explicit spsc_queue(size_t capacity);
+  // false when full
+  bool push(int item);
+  // false when empty
+  bool pop(int *item);
+  size_t size() const;
+};
+
+// writes a sequence of frames on a thread of its own so that rendering never
+// waits for the disk or an encoder. frames are copied into buffers from a
+// fixed pool, which go to the writer and back through lock-free queues. when
+// the writer falls so far behind that every buffer is waiting, frames are
+// dropped instead
+class frame_writer {
+public:
+  enum class format { ppm, pfm, y4m };
+private:
+  struct buffer {
+    std::vector<uint8_t> rgba8;
+    std::vector<float> rgba;
+    int width, height;
+    unsigned long long int number;
+  };
+  format _format;
+  // numbered files are named the prefix, the frame number padded to at
+  // least _number_width with zeros or spaces, and the suffix
+  std::string _name_prefix, _name_suffix;
+  int _number_width;
+  bool _number_zeros;
+  int _width, _height;
+  FILE *_stream;
+  std::vector<buffer> _buffers;
+  // buffers ready to be filled and those waiting to be written
+  spsc_queue _free, _full;
+  // the buffer begin_frame() handed out, -1 for none
+  int _filling;
+  // frames queued and dropped by the rendering thread, and written by the
+  // writer
+  unsigned long long int _frames, _dropped;
+  std::atomic<unsigned long long int> _written;
+  std::atomic<bool> _quit;
+  // the writer sleeps on this while there is nothing to write
+  std::mutex _mutex;
+  std::condition_variable _wake;
+  // the planes of a y4m frame
+  std::vector<uint8_t> _planes;
+  std::thread _thread;
+
+  void _parse_name(const std::string &path);
+  void _run();
+  void _write(const buffer &b);
+  void _write_y4m(const buffer &b);
+public:
+  // `path` ending in .y4m, or "-" for standard output, is one stream of
+  // frames of `width` x `height`, 8-bit rgba converted to 4:4:4 Y'CbCr.
+  // otherwise it names the numbered .ppm files of 8-bit rgba or .pfm files
+  // of linear float rgba frames up to that size. where the number goes is
+  // marked like printf's %d, %5d or %05d, and %% is a literal %. a
+  // stream on standard output takes it over, what the program prints goes
+  // to standard error instead
+  frame_writer(const std::string &path, int width, int height, int fps
+      , int buffers);
+  // writes what is queued, then stops the writer
+  ~frame_writer();
+  format get_format() const;
+  // a buffer to copy the next frame into, rgba8 or float rgba by the
+  // format, bottom row first as image.hh takes them. nullptr if none is
+  // free, the frame is dropped then
+  void* begin_frame();
+  // queues the frame copied into the buffer from begin_frame()
+  void end_frame(int width, int height);
+  // counts a frame that did not even get to begin_frame() as dropped
+  void drop_frame();
+  // frames queued so far, written or not
+  unsigned long long int get_frames() const;
+  unsigned long long int get_written() const;
+  unsigned long long int get_dropped() const;
+  // frames waiting to be written
+  int get_queued() const;
+};
@@ -0,0 +1,77 @@
+#include "image.hh"
+#include "utils.hh"
+#include <cmath>
+#include <cstdio>
+
+void write_ppm(const std::string &filename, int width, int height
+    , const std::vector<uint8_t> &rgba) {
+  FILE *f = fopen(filename.c_str(), "wb");
+  assertf(f, "failed to open \"%s\" for writing", filename.c_str());
+  fprintf(f, "P6\n%d %d\n255\n", width, height);
+  std::vector<uint8_t> row(width * 3);
+  // ppm rows go top to bottom
+  for (int y = height - 1; y >= 0; y--) {
+    const uint8_t *src = &rgba[(size_t)y * width * 4];
+    for (int x = 0; x < width; x++)
+      for (int c = 0; c < 3; c++)
+        row[x * 3 + c] = src[x * 4 + c];
+    fwrite(row.data(), 1, row.size(), f);
+  }
+  fclose(f);
+}
+
+void write_pfm(const std::string &filename, int width, int height
+    , const std::vector<float> &rgba) {
+  FILE *f = fopen(filename.c_str(), "wb");
+  assertf(f, "failed to open \"%s\" for writing", filename.c_str());
+  // negative scale means little endian. pfm rows go bottom to top
+  fprintf(f, "PF\n%d %d\n-1.0\n", width, height);
+  std::vector<float> row(width * 3);
+  for (int y = 0; y < height; y++) {
+    const float *src = &rgba[(size_t)y * width * 4];
+    for (int x = 0; x < width; x++)
+      for (int c = 0; c < 3; c++)
+        row[x * 3 + c] = src[x * 4 + c];
+    fwrite(row.data(), sizeof(float), row.size(), f);
+  }
+  fclose(f);
+}
+
+void read_pfm(const std::string &filename, int *width, int *height
+    , std::vector<float> *rgba) {
+  FILE *f = fopen(filename.c_str(), "rb");
+  assertf(f, "failed to open \"%s\"", filename.c_str());
+  char type[3] = {};
+  float scale;
+  if (fscanf(f, "%2s %d %d %f", type, width, height, &scale) != 4
+      || std::string(type) != "PF" || *width <= 0 || *height <= 0
+      || fgetc(f) == EOF)
+    die("\"%s\" is not an rgb pfm", filename.c_str());
+  if (scale >= 0.f)
+    die("\"%s\" is big endian", filename.c_str());
+  rgba->assign((size_t)*width * *height * 4, 1.f);
+  std::vector<float> row(*width * 3);
+  for (int y = 0; y < *height; y++) {
+    if (fread(row.data(), sizeof(float), row.size(), f) != row.size())
+      die("\"%s\" is truncated", filename.c_str());
+    float *dst = &(*rgba)[(size_t)y * *width * 4];
+    for (int x = 0; x < *width; x++)
+      for (int c = 0; c < 3; c++)
+        dst[x * 4 + c] = row[x * 3 + c];
+  }
+  fclose(f);
+}
+
+double image_rmse(const std::vector<float> &a, const std::vector<float> &b) {
+  double sum = 0.;
+  for (size_t i = 0; i < a.size(); i++)
+    if (i % 4 != 3)
+      sum += ((double)a[i] - b[i]) * ((double)a[i] - b[i]);
+  return std::sqrt(sum / (a.size() / 4 * 3));
+}
+
+bool image_wants_float(const std::string &filename) {
+  return filename.size() >= 4
+    && filename.compare(filename.size() - 4, 4, ".pfm") == 0;
+}
+
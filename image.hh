@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// images are stored bottom row first, the way the renderer produces them.
+// ppm takes 8-bit rgba, pfm takes linear float rgba
+void write_ppm(const std::string &filename, int width, int height
+    , const std::vector<uint8_t> &rgba);
+void write_pfm(const std::string &filename, int width, int height
+    , const std::vector<float> &rgba);
+// reads what write_pfm writes, dies if it cannot
+void read_pfm(const std::string &filename, int *width, int *height
+    , std::vector<float> *rgba);
+// root mean square error of the rgb of two images of the same size
+double image_rmse(const std::vector<float> &a, const std::vector<float> &b);
+// picks the format by the extension of `filename`
+bool image_wants_float(const std::string &filename);
+
@@ -1,56 +1,64 @@
 #include "screen.hh"
 #include "ogl.hh"
-#include <GL/glx.h>
-#include <CL/cl.hpp>
-
-struct process_params {
-  cl::Device device;
-  cl::Context context;
-  cl::CommandQueue queue;
-  cl::Program program;
-  cl::Kernel kernel;
-  cl::ImageGL tex;
-  std::vector<cl::Memory> objs;
-} params;
-cl::Buffer cl_spheres;
+#include "ocl.hh"
+#include "options.hh"
+#include "scene.hh"
+#include "cl_renderer.hh"
+#include "split_renderer.hh"
+#include "cpu_renderer.hh"
+#include "image.hh"
+#include "bench.hh"
+#include "profiler.hh"
+#include "frame_budget.hh"
+#include "frame_writer.hh"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+options opts;
+renderer *g_renderer;
+// with --profile
+frame_profiler *profiler;
+// set when the renderer does not draw into rparams.textures by itself
+bool upload_frames;
+std::vector<float> frame_radiance;
+// with --pipeline, frames go round rparams.textures
+cl_renderer *pipeline;
+// with --frame-budget, picks samples, bounces and the render resolution
+frame_budget *budget;
+// the window's size divided by render_scale
+int render_width, render_height, render_scale;
+// the draw that recreated the renderer took longer than any frame
+bool skip_frame_time;
+// with --record, writes the frames read back from the window
+frame_writer *recorder;
+
+// a frame being read back for the recorder: the GPU copies it into a pixel
+// buffer after the draw, and the fence tells when it is done
+struct record_readback {
+  GLuint buffer;
+  GLsync fence;
+  int width, height;
+};
+// readbacks in flight, beyond which frames are dropped, the frames the
+// writer holds, and the rate players show them at. frames are recorded as
+// they are drawn
+static const int record_readbacks = 3, record_buffers = 8, record_fps = 30;
+// a ring of them, the oldest in flight first
+static std::vector<record_readback> readbacks;
+static size_t readback_first, readbacks_pending;
 
 struct render_params {
   shader_program *sp;
   GLuint vao;
-  GLuint tex;
-  int mat_loc, tex_loc;
+  // one unless pipelining
+  std::vector<GLuint> textures;
+  // the texture drawn, -1 before the pipeline's first frame is done
+  int shown;
+  int mat_loc, tex_loc, exposure_loc, tone_map_loc;
 } rparams;
 
-struct Sphere {
-  cl_float radius;
-  cl_float dummy1;
-  cl_float dummy2;
-  cl_float dummy3;
-  cl_float3 position;
-  cl_float3 color;
-  cl_float3 emission;
-  Sphere(cl_float n_radius, cl_float3 n_position, cl_float3 n_color
-      , cl_float3 n_emission)
-    : radius(n_radius)
-    , position(n_position)
-    , color(n_color)
-    , emission(n_emission) {
-  }
-};
-
-#define _float3(x, y, z) {{ x, y, z }} // macro to replace ugly initializer braces
-Sphere cpu_spheres[] = {
-  Sphere(200.f, _float3(-200.6f, 0.0f, 0.0f),   _float3(0.75f, 0.25f, 0.25f), _float3(0, 0, 0)),
-  Sphere(200.f, _float3(200.6f, 0.0f, 0.0f),    _float3(0.25f, 0.25f, 0.75f), _float3(0, 0, 0)),
-  Sphere(200.f, _float3(0.0f, -200.4f, 0.0f),   _float3(0.9f, 0.8f, 0.7f),    _float3(0, 0, 0)),
-  Sphere(200.f, _float3(0.0f, 200.4f, 0.0f),    _float3(0.9f, 0.8f, 0.7f),    _float3(0, 0, 0)),
-  Sphere(200.f, _float3(0.0f, 0.0f, -200.4f),   _float3(0.9f, 0.8f, 0.7f),    _float3(0, 0, 0)),
-  Sphere(200.f, _float3(0.0f, 0.0f, 202.0f),    _float3(0.9f, 0.8f, 0.7f),    _float3(0, 0, 0)),
-  Sphere(0.16f, _float3(-0.25f, -0.24f, -0.1f), _float3(0.9f, 0.8f, 0.7f),    _float3(0, 0, 0)),
-  Sphere(0.16f, _float3(0.25f, -0.24f, 0.1f),   _float3(0.9f, 0.8f, 0.7f),    _float3(0, 0, 0)),
-  Sphere(  1.f, _float3(0.0f, 1.36f, 0.0f),     _float3(0.0f, 0.0f, 0.0f),    _float3(9.0f, 8.0f, 6.0f))
-};
-const int num_spheres = sizeof(cpu_spheres) / sizeof(Sphere);
+scene world;
 
 static const float proj_matrix[16] = {
   1.f, 0.f, 0.f, 0.f,
@@ -59,62 +67,183 @@ static const float proj_matrix[16] = {
   0.f, 0.f, 0.f, 1.f
 };
 
-screen *g_screen = new screen("bblik", 800, 600);
+screen *g_screen;
 
 int samples = 10, bounces = 8;
-
-void check_clgl_interop_availiability(const cl::Device &device) {
+bool animate = true, wavefront = false, nee = true, denoise = false
+  , temporal = false;
+// how screen.frag displays the radiance in the textures
+float exposure;
+int tone_map;
+static const char *tone_maps[] = { "clip", "reinhard", "aces" };
+
+static bool has_clgl_interop(const cl::Device &device) {
 #if defined (__APPLE__) || defined(MACOSX)
   std::string cl_gl_sharing_ext_name = "cl_APPLE_gl_sharing";
 #else
   std::string cl_gl_sharing_ext_name = "cl_khr_gl_sharing";
 #endif
-  std::string extensions = device.getInfo<CL_DEVICE_EXTENSIONS>();
-  std::size_t found = extensions.find(cl_gl_sharing_ext_name); // TODO
-  if (found == std::string::npos)
-    die("device \"%s\" does not support OpenGL-OpenCL interoperability"
-        , device.getInfo<CL_DEVICE_NAME>().c_str());
+  return ocl_device_has_extension(device, cl_gl_sharing_ext_name);
 }
 
-void load() {
-  std::vector<cl::Platform> platforms;
-  cl::Platform::get(&platforms);
-  cl::Platform platform = platforms[0];
-
-  std::vector<cl::Device> devices;
-  platform.getDevices(CL_DEVICE_TYPE_GPU, &devices);
-  params.device = devices[0];
-  check_clgl_interop_availiability(params.device);
-
-  cl_context_properties properties[] = {
-    CL_GL_CONTEXT_KHR, (cl_context_properties)glXGetCurrentContext(),
-    CL_GLX_DISPLAY_KHR, (cl_context_properties)glXGetCurrentDisplay(),
-    CL_CONTEXT_PLATFORM, (cl_context_properties)platform(),
-    0
-  };
+static renderer* create_cl_renderer(int width, int height
+    , const std::vector<GLuint> &gl_texs) {
+  std::vector<ocl_device> devices = ocl_select_devices(opts.platform
+      , opts.device, ocl_device_type(opts.device_type));
+  for (const ocl_device &d : devices)
+    printf("using \"%s\" (%s)\n", d.device.getInfo<CL_DEVICE_NAME>().c_str()
+        , d.platform.getInfo<CL_PLATFORM_NAME>().c_str());
+  if (devices.size() > 1)
+    return new split_renderer(devices, width, height);
+  // without interop frames are copied into the textures, which only
+  // overlaps with rendering when frames are pipelined. renderers come and go
+  // with the render scale, the warning does not
+  static bool warned = false;
+  bool gl_sharing = gl_texs.empty() || has_clgl_interop(devices[0].device);
+  if (!gl_sharing && !warned) {
+    warned = true;
+    warning("device \"%s\" does not support OpenGL-OpenCL interoperability, "
+        "frames are copied through pixel buffer objects%s"
+        , devices[0].device.getInfo<CL_DEVICE_NAME>().c_str()
+        , gl_texs.size() > 1 ? "" : ", --pipeline 2 overlaps that with "
+        "rendering");
+  }
+  return new cl_renderer(devices[0].platform, devices[0].device, width, height
+      , gl_texs, gl_sharing);
+}
+
+// the native renderer stands in when there is no OpenCL device to use
+static renderer* create_renderer(int width, int height
+    , const std::vector<GLuint> &gl_texs) {
+  renderer *r;
+  if (opts.backend == "cpu" || (opts.backend == "auto"
+        && !ocl_has_devices(ocl_device_type(opts.device_type)))) {
+    cpu_renderer *cpu = new cpu_renderer(width, height, opts.threads);
+    printf("using the native renderer with %d threads and packets of %d "
+        "rays\n", cpu->get_threads(), cpu->get_packet_width());
+    r = cpu;
+  } else
+    r = create_cl_renderer(width, height, gl_texs);
+  r->set_wavefront(wavefront);
+  r->set_adaptive(opts.adaptive);
+  r->set_nee(nee);
+  r->set_sampler(opts.sampler == "random" ? sampler_type::random
+      : opts.sampler == "sobol" ? sampler_type::sobol
+      : sampler_type::blue_noise);
+  r->set_denoise(denoise);
+  r->set_temporal(temporal);
+  r->set_profiler(profiler);
+  // frames are timed once the specialised kernels are in, and an offline
+  // render is long enough to wait for them
+  r->set_specialise(opts.specialise, opts.bench || opts.headless);
+  return r;
+}
+
+// (re)creates the renderer for the window's size divided by `scale`, and
+// the textures it renders into with it, of half floats so that they keep
+// radiance above 1 for the tone mapping. drawing stretches them over the
+// window. accumulated samples are lost
+static void set_render_scale(int scale) {
+  // interop images of the textures go before the textures change
+  delete g_renderer;
+  render_scale = scale;
+  render_width = std::max(g_screen->get_window_width() / scale, 1);
+  render_height = std::max(g_screen->get_window_height() / scale, 1);
+  for (GLuint tex : rparams.textures) {
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, render_width, render_height
+        , 0, GL_RGBA, GL_FLOAT, nullptr);
+  }
+
+  g_renderer = create_renderer(render_width, render_height, rparams.textures);
+  upload_frames = dynamic_cast<cl_renderer*>(g_renderer) == nullptr;
+  rparams.shown = 0;
+  pipeline = nullptr;
+  if (rparams.textures.size() > 1) {
+    pipeline = dynamic_cast<cl_renderer*>(g_renderer);
+    if (pipeline)
+      rparams.shown = -1;
+    else
+      warning("frames are only pipelined on a single OpenCL device");
+  }
+}
 
-  params.context = cl::Context(params.device, properties);
+// bytes of a pixel the recorder takes: linear radiance for .pfm, what the
+// window shows otherwise
+static size_t record_pixel_size() {
+  return recorder->get_format() == frame_writer::format::pfm
+    ? 4 * sizeof(float) : 4;
+}
 
-  params.queue = cl::CommandQueue(params.context, params.device);
+static void init_recording() {
+  readbacks.resize(record_readbacks);
+  size_t size = (size_t)g_screen->get_window_width()
+    * g_screen->get_window_height() * record_pixel_size();
+  for (record_readback &r : readbacks) {
+    glGenBuffers(1, &r.buffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, r.buffer);
+    glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  readback_first = readbacks_pending = 0;
+}
 
-  std::string source = read_file_to_string("opencl_kernel.cl");
-  const char *source_c_str = source.c_str();
-  params.program = cl::Program(params.context, source_c_str);
-  // "-cl-fast-relaxed-math"
-  cl_int result = params.program.build({ params.device });
-  if (result) {
-    if (result == CL_BUILD_PROGRAM_FAILURE) {
-      std::string build_log
-        = params.program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(params.device);
-      printf("Build log:\n%s\n", build_log.c_str());
+// hands the frames whose readbacks are done to the recorder, oldest first.
+// with `wait` all of them, waiting for the GPU
+static void collect_readbacks(bool wait) {
+  while (readbacks_pending) {
+    record_readback &r = readbacks[readback_first];
+    GLenum status = glClientWaitSync(r.fence, GL_SYNC_FLUSH_COMMANDS_BIT
+        , wait ? 1000000000 : 0);
+    if (status == GL_TIMEOUT_EXPIRED && wait)
+      continue;
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+      break;
+    glDeleteSync(r.fence);
+    // a frame the writer has no buffer for is dropped
+    if (void *dst = recorder->begin_frame()) {
+      size_t size = (size_t)r.width * r.height * record_pixel_size();
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, r.buffer);
+      memcpy(dst, glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size
+            , GL_MAP_READ_BIT), size);
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+      recorder->end_frame(r.width, r.height);
     }
-    die("Failed to compile OpenCL program (%d)", result);
+    readback_first = (readback_first + 1) % readbacks.size();
+    --readbacks_pending;
   }
+}
 
-  params.kernel = cl::Kernel(params.program, "render_kernel");
+// queues the readback of the frame just drawn without waiting for it: the
+// window's pixels, or for .pfm the radiance of the texture drawn, at the
+// render resolution
+static void record_frame() {
+  collect_readbacks(false);
+  if (readbacks_pending == readbacks.size()) {
+    recorder->drop_frame();
+    return;
+  }
+  record_readback &r = readbacks[(readback_first + readbacks_pending)
+    % readbacks.size()];
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, r.buffer);
+  if (recorder->get_format() == frame_writer::format::pfm) {
+    r.width = render_width;
+    r.height = render_height;
+    glBindTexture(GL_TEXTURE_2D, rparams.textures[rparams.shown]);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, nullptr);
+  } else {
+    r.width = g_screen->get_window_width();
+    r.height = g_screen->get_window_height();
+    glReadPixels(0, 0, r.width, r.height, GL_RGBA, GL_UNSIGNED_BYTE
+        , nullptr);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  r.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  ++readbacks_pending;
+}
 
-  cl_spheres = cl::Buffer(params.context, CL_MEM_READ_ONLY
-      , num_spheres * sizeof(Sphere));
+void load() {
 
   // create opengl stuff
   glClearColor(0.2, 0.2, 0.2, 1.0);
@@ -126,18 +255,20 @@ void load() {
   rparams.mat_loc = rparams.sp->bind_uniform("matrix");
   rparams.tex_loc = rparams.sp->bind_uniform("tex");
   glUniform1i(rparams.tex_loc, 0);
-
-  glGenTextures(1, &rparams.tex);
-  glBindTexture(GL_TEXTURE_2D, rparams.tex);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-  // need to set GL_NEAREST
-  // (not GL_NEAREST_MIPMAP_* which would cause CL_INVALID_GL_OBJECT later)
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8 /*GL_RGBA8*/
-      , g_screen->get_window_width(), g_screen->get_window_height(), 0
-      , GL_RGBA, GL_FLOAT, nullptr);
+  rparams.exposure_loc = rparams.sp->bind_uniform("exposure");
+  rparams.tone_map_loc = rparams.sp->bind_uniform("tone_map");
+
+  rparams.textures.resize(std::max(opts.pipeline, 1));
+  glGenTextures(rparams.textures.size(), rparams.textures.data());
+  for (GLuint tex : rparams.textures) {
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    // need to set GL_NEAREST
+    // (not GL_NEAREST_MIPMAP_* which would cause CL_INVALID_GL_OBJECT later)
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  }
 
   array_buffer vbo;
   const std::vector<float> screen_vertices = {
@@ -173,13 +304,16 @@ void load() {
   ebo.bind();
   glBindVertexArray(0);
 
-  // create opencl texture reference using opengl texture
-  cl_int err_code;
-  params.tex = cl::ImageGL(params.context, CL_MEM_WRITE_ONLY, GL_TEXTURE_2D, 0
-      , rparams.tex, &err_code);
-  assertf(err_code == CL_SUCCESS, "Failed to create OpenGL texture refrence "
-      "(%d)", err_code);
-  params.objs.push_back(params.tex);
+  set_render_scale(1);
+  if (recorder)
+    init_recording();
+}
+
+static void write_profile() {
+  if (!profiler)
+    return;
+  profiler->print_stats();
+  profiler->write_trace(opts.profile);
 }
 
 static void key_event(char key, bool down) {
@@ -194,6 +328,43 @@ static void key_event(char key, bool down) {
     if (key == 's')
       if (bounces)
         --bounces;
+    if (key == 'f')
+      animate = !animate;
+    if (key == 'm') {
+      wavefront = !wavefront;
+      g_renderer->set_wavefront(wavefront);
+    }
+    if (key == 'n') {
+      nee = !nee;
+      g_renderer->set_nee(nee);
+    }
+    if (key == 'd') {
+      denoise = !denoise;
+      g_renderer->set_denoise(denoise);
+    }
+    if (key == 't') {
+      temporal = !temporal;
+      g_renderer->set_temporal(temporal);
+    }
+    if (key == 'b' && opts.frame_budget > 0.f) {
+      if (budget) {
+        delete budget;
+        budget = nullptr;
+        if (render_scale != 1)
+          set_render_scale(1);
+      } else
+        budget = new frame_budget(opts.frame_budget, opts.budget_resolution
+            , samples, bounces);
+      skip_frame_time = true;
+    }
+    if (key == 'x')
+      exposure += 0.5f;
+    if (key == 'z')
+      exposure -= 0.5f;
+    if (key == 'c')
+      tone_map = (tone_map + 1) % (sizeof(tone_maps) / sizeof(*tone_maps));
+    if (key == 'p')
+      write_profile();
   }
 }
 
@@ -204,62 +375,330 @@ static void mouse_motion_event(float xrel, float yrel, int x, int y) {
 static void mouse_button_event(int button, bool down, int x, int y) {
 }
 
-static void update(double dt, double t) {
-  cpu_spheres[6].position.s[0] = -0.25f + cos((t * 10.f) / 5.f) / 8.f;
-  cpu_spheres[6].position.s[1] = sin((t * 10.f) / 11.f) / 10.f;
-  cpu_spheres[6].position.s[2] = -0.1f + cos((t * 10.f) / 7.f) / 6.f;
+static void move_sphere(int i, const cl_float3 &position) {
+  if (memcmp(&world.spheres[i].position, &position, sizeof(position)) == 0)
+    return;
+  world.spheres[i].position = position;
+  world.sphere_changed(i);
+}
 
-  printf("\rsamples=%3d, bounces=%3d ", samples, bounces);
+static void update(double dt, double t) {
+  static double anim_t = 0;
+  if (animate)
+    anim_t += dt;
+  cl_float3 position = world.spheres[6].position;
+  position.s[0] = -0.25f + cos((anim_t * 10.f) / 5.f) / 8.f;
+  position.s[1] = sin((anim_t * 10.f) / 11.f) / 10.f;
+  position.s[2] = -0.1f + cos((anim_t * 10.f) / 7.f) / 6.f;
+  move_sphere(6, position);
+  world.commit();
+
+  // what frames are rendered with, under the budget at most what was set
+  printf("\rsamples=%3d, bounces=%3d, spp=%7llu, %s%s%s%s, %+.1f EV %s"
+      , budget ? budget->get_samples() : samples, budget
+      ? budget->get_bounces() : bounces
+      , g_renderer->get_accumulated_samples()
+      , wavefront ? "wavefront" : "megakernel", nee ? ", nee" : ""
+      , denoise ? ", denoised" : "", temporal ? ", temporal" : "", exposure
+      , tone_maps[tone_map]);
+  if (budget)
+    printf(", budget %.1f ms at 1/%d resolution", opts.frame_budget
+        , render_scale);
+  if (recorder)
+    printf(", recorded %llu (%d queued, %llu dropped)"
+        , recorder->get_frames(), recorder->get_queued()
+        , recorder->get_dropped());
+  printf(" ");
+  fflush(stdout);
 }
 
 static void draw(double alpha) {
   glViewport(0, 0, g_screen->get_window_width(), g_screen->get_window_height());
 
-  glFinish();
-
-  params.queue.enqueueWriteBuffer(cl_spheres, CL_FALSE, 0
-      , num_spheres * sizeof(Sphere), cpu_spheres);
-
-  params.queue.enqueueAcquireGLObjects(&params.objs);
+  int frame_samples = samples, frame_bounces = bounces;
+  if (budget) {
+    budget->update(skip_frame_time ? 0. : g_screen->get_draw_ms(), samples
+        , bounces);
+    skip_frame_time = false;
+    if (budget->get_scale() != render_scale) {
+      set_render_scale(budget->get_scale());
+      skip_frame_time = true;
+    }
+    frame_samples = budget->get_samples();
+    frame_bounces = budget->get_bounces();
+  }
 
-  params.kernel.setArg(0, samples);
-  params.kernel.setArg(1, bounces);
-  params.kernel.setArg(2, cl_spheres);
-  params.kernel.setArg(3, num_spheres);
-  params.kernel.setArg(4, params.objs[0]);
-  params.kernel.setArg(5, g_screen->get_window_width());
-  params.kernel.setArg(6, g_screen->get_window_height());
+  if (pipeline) {
+    // no glFinish, each texture has a fence for the frame that renders
+    // into it next. the frame shown is the newest finished one while the
+    // next is still rendering
+    int finished;
+    {
+      profile_scope scope(profiler, "render");
+      finished = pipeline->render_async(world, frame_samples
+          , frame_bounces);
+    }
+    if (finished >= 0)
+      rparams.shown = finished;
+  } else {
+    {
+      profile_scope scope(profiler, "glFinish");
+      glFinish();
+    }
 
-  size_t local_work_size = params.kernel.getWorkGroupInfo<
-    CL_KERNEL_WORK_GROUP_SIZE>(params.device)
-    , global_work_size = g_screen->get_window_width()
-    * g_screen->get_window_height();
-  if (global_work_size % local_work_size != 0)
-    global_work_size = (global_work_size / local_work_size + 1)
-      * local_work_size;
+    {
+      profile_scope scope(profiler, "render");
+      g_renderer->render(world, frame_samples, frame_bounces);
+    }
+    if (upload_frames) {
+      {
+        profile_scope scope(profiler, "read image");
+        g_renderer->read_radiance(&frame_radiance);
+      }
+      profile_scope scope(profiler, "texture upload");
+      glBindTexture(GL_TEXTURE_2D, rparams.textures[0]);
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, render_width, render_height
+          , GL_RGBA, GL_FLOAT, frame_radiance.data());
+    }
+  }
 
-  params.queue.enqueueNDRangeKernel(params.kernel, cl::NullRange
-      , global_work_size, local_work_size);
+  {
+    // only issuing the draw, the GPU runs it during the next glFinish
+    profile_scope scope(profiler, "blit");
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    if (rparams.shown >= 0) {
+      rparams.sp->use_this_prog();
+      glActiveTexture(GL_TEXTURE0);
+      glBindTexture(GL_TEXTURE_2D, rparams.textures[rparams.shown]);
+      glUniformMatrix4fv(rparams.mat_loc, 1, GL_FALSE, proj_matrix);
+      glUniform1f(rparams.exposure_loc, exposure);
+      glUniform1i(rparams.tone_map_loc, tone_map);
+      glBindVertexArray(rparams.vao);
+      glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+      glBindVertexArray(0);
+      // reading the texture back comes before its fence
+      if (recorder)
+        record_frame();
+      if (pipeline)
+        pipeline->set_texture_fence(rparams.shown
+            , glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+    }
+  }
+  if (profiler)
+    profiler->end_frame();
+}
 
-  params.queue.enqueueReleaseGLObjects(&params.objs);
-  params.queue.finish();
+static void cleanup() {
+  puts("");
+  write_profile();
+  if (recorder) {
+    collect_readbacks(true);
+    for (record_readback &r : readbacks)
+      glDeleteBuffers(1, &r.buffer);
+    unsigned long long int frames = recorder->get_frames()
+      , dropped = recorder->get_dropped();
+    // waits for the writer to catch up
+    delete recorder;
+    recorder = nullptr;
+    printf("recorded %llu frames to %s, %llu dropped\n", frames
+        , opts.record.c_str(), dropped);
+  }
+}
 
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-  rparams.sp->use_this_prog();
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, rparams.tex);
-  glUniformMatrix4fv(rparams.mat_loc, 1, GL_FALSE, proj_matrix);
-  glBindVertexArray(rparams.vao);
-  glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
-  glBindVertexArray(0);
+// copies the rows [y_begin, y_end) and columns [x_begin, x_end) of an image
+// whose pixel (x0, y0) is the first of `src` into `dst`, of pixels of
+// `channels` values
+template <typename T>
+static void copy_pixels(const std::vector<T> &src, int src_width, int x0
+    , int y0, std::vector<T> *dst, int dst_width, int x_begin, int x_end
+    , int y_begin, int y_end, int channels) {
+  for (int y = y_begin; y < y_end; y++)
+    std::copy_n(&src[((size_t)(y - y0) * src_width + x_begin - x0)
+        * channels], (size_t)(x_end - x_begin) * channels
+        , &(*dst)[((size_t)y * dst_width + x_begin) * channels]);
 }
 
-static void cleanup() {
+static void headless() {
+  // images larger than a tile are rendered a tile at a time on a renderer
+  // of the size of one, so that the device holds the same buffers and every
+  // launch has the same work however large they are. with denoising, tiles
+  // are rendered with a margin the filter reaches into, so that it does not
+  // show where they meet. the margins are kept inside the image, the
+  // filter stops at its edges
+  bool tiled = opts.tile > 0
+    && (opts.width > opts.tile || opts.height > opts.tile);
+  int tile_width = tiled ? std::min(opts.tile, opts.width) : opts.width
+    , tile_height = tiled ? std::min(opts.tile, opts.height) : opts.height
+    , margin = tiled && denoise ? denoise_radius : 0
+    , view_width = std::min(tile_width + 2 * margin, opts.width)
+    , view_height = std::min(tile_height + 2 * margin, opts.height)
+    , tiles_x = (opts.width + tile_width - 1) / tile_width
+    , tiles_y = (opts.height + tile_height - 1) / tile_height
+    , tiles = tiles_x * tiles_y;
+  printf("rendering %dx%d at %d spp (%s%s%s, %s sampler)", opts.width
+      , opts.height, opts.spp, wavefront ? "wavefront" : "megakernel"
+      , nee ? ", nee" : "", denoise ? ", denoised" : ""
+      , opts.sampler.c_str());
+  if (tiled)
+    printf(" in %d tiles of %dx%d", tiles, tile_width, tile_height);
   puts("");
+  // the error of the render as it converges, for comparing samplers
+  std::vector<float> reference, radiance;
+  if (!opts.reference.empty()) {
+    int width, height;
+    read_pfm(opts.reference, &width, &height, &reference);
+    if (width != opts.width || height != opts.height)
+      die("reference \"%s\" is %dx%d, not %dx%d", opts.reference.c_str()
+          , width, height, opts.width, opts.height);
+  }
+  unsigned long long int next_error = 1;
+  renderer *headless_renderer = create_renderer(view_width, view_height, {});
+  bool want_float = image_wants_float(opts.output);
+  std::vector<float> rgba_float;
+  std::vector<uint8_t> rgba8;
+  // tiles are read back into the whole image as they finish
+  if (tiled && want_float)
+    rgba_float.resize((size_t)opts.width * opts.height * 4);
+  else if (tiled)
+    rgba8.resize((size_t)opts.width * opts.height * 4);
+  // the image is built up over several launches to keep each one short.
+  // with adaptive sampling --spp is a budget that may not all be needed
+  int samples_per_launch = std::max(samples, 1);
+  auto start = std::chrono::steady_clock::now();
+  int last_view_x = -1, last_view_y = -1;
+  for (int tile = 0; tile < tiles; tile++) {
+    int x0 = tile % tiles_x * tile_width, y0 = tile / tiles_x * tile_height
+      , view_x = std::max(std::min(x0 - margin, opts.width - view_width), 0)
+      , view_y = std::max(std::min(y0 - margin, opts.height - view_height)
+          , 0);
+    // tiles whose margins are cut by the image's edges can take the same
+    // view as the one before, which has them rendered already
+    bool rendered = view_x == last_view_x && view_y == last_view_y;
+    last_view_x = view_x;
+    last_view_y = view_y;
+    if (tiled)
+      headless_renderer->set_view(view_x, view_y, opts.width, opts.height);
+    for (unsigned long long int done = 0; done < (unsigned)opts.spp
+        && !rendered; ) {
+      headless_renderer->render(world
+          , (int)std::min<unsigned long long>(samples_per_launch
+            , opts.spp - done), bounces);
+      if (profiler)
+        profiler->end_frame();
+      unsigned long long int now
+        = headless_renderer->get_accumulated_samples();
+      if (tiled)
+        printf("\rtile %d/%d, %llu/%d spp", tile + 1, tiles, now, opts.spp);
+      else
+        printf("\r%llu/%d spp", now, opts.spp);
+      if (!tiled && !reference.empty() && now >= next_error) {
+        headless_renderer->read_radiance(&radiance);
+        printf(", rmse %.6f\n", image_rmse(radiance, reference));
+        while (next_error <= now)
+          next_error *= 2;
+      }
+      fflush(stdout);
+      if (now == done) {
+        printf(", converged");
+        if (tiled)
+          puts("");
+        break;
+      }
+      done = now;
+    }
+    if (!tiled)
+      break;
+    int x_end = std::min(x0 + tile_width, opts.width)
+      , y_end = std::min(y0 + tile_height, opts.height);
+    if (want_float) {
+      headless_renderer->read_radiance(&radiance);
+      copy_pixels(radiance, view_width, view_x, view_y, &rgba_float
+          , opts.width, x0, x_end, y0, y_end, 4);
+    } else {
+      std::vector<uint8_t> tile_rgba8;
+      headless_renderer->read_rgba8(&tile_rgba8);
+      copy_pixels(tile_rgba8, view_width, view_x, view_y, &rgba8
+          , opts.width, x0, x_end, y0, y_end, 4);
+    }
+  }
+  double seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+  printf("\n%.2f s, %.1f Msamples/s\n", seconds
+      , (double)opts.width * opts.height * opts.spp / seconds / 1e6);
+  if (split_renderer *split = dynamic_cast<split_renderer*>(headless_renderer))
+    split->print_split();
+  write_profile();
+
+  if (!tiled && want_float)
+    headless_renderer->read_radiance(&rgba_float);
+  else if (!tiled)
+    headless_renderer->read_rgba8(&rgba8);
+  // tiles only have the error of the whole image once all are done
+  if (tiled && want_float && !reference.empty())
+    printf("rmse %.6f\n", image_rmse(rgba_float, reference));
+  if (want_float)
+    write_pfm(opts.output, opts.width, opts.height, rgba_float);
+  else
+    write_ppm(opts.output, opts.width, opts.height, rgba8);
+  printf("wrote %s\n", opts.output.c_str());
+  delete headless_renderer;
 }
 
-int main() {
-  g_screen->mainloop(load, key_event, mouse_motion_event, mouse_button_event
-      , update, draw, cleanup);
+int main(int argc, char **argv) {
+  parse_options(argc, argv, &opts);
+  samples = opts.samples;
+  bounces = opts.bounces;
+  wavefront = opts.wavefront;
+  nee = opts.nee;
+  denoise = opts.denoise;
+  temporal = opts.temporal;
+  exposure = opts.exposure;
+  tone_map = std::find(std::begin(tone_maps), std::end(tone_maps)
+      , opts.tone_map) - std::begin(tone_maps);
+  ocl_set_program_cache(opts.kernel_cache);
+  ocl_set_build_options(opts.cl_math == "mad" ? "-cl-mad-enable"
+      : opts.cl_math == "fast" ? "-cl-fast-relaxed-math" : "");
+  if (opts.bench || opts.bench_denoise) {
+    auto create = [](int width, int height) {
+      return create_renderer(width, height, {});
+    };
+    std::string mode = std::string(wavefront ? "wavefront" : "megakernel")
+      + (nee ? ", nee" : "") + (opts.adaptive > 0.f ? ", adaptive" : "")
+      + (opts.specialise ? ", specialised" : "") + ", math " + opts.cl_math
+      + ", " + opts.sampler + " sampler";
+    if (opts.bench_denoise)
+      run_denoise_bench(create, opts.bench_runs, mode, opts.output);
+    else
+      run_bench(create, opts.bench_runs, mode + (denoise ? ", denoised" : "")
+          , opts.output);
+    return 0;
+  }
+  // a stream on standard output takes it over before anything is printed
+  if (!opts.record.empty() && !opts.headless && !opts.list_devices)
+    recorder = new frame_writer(opts.record, opts.width, opts.height
+        , record_fps, record_buffers);
+  if (!opts.profile.empty())
+    profiler = new frame_profiler();
+  load_scene(opts.scene, &world);
+  printf("scene \"%s\": %zu spheres, bvh of %zu nodes and depth %d\n"
+      , opts.scene.c_str(), world.spheres.size()
+      , world.sphere_bvh.nodes.size(), world.sphere_bvh.get_depth());
+  if (!world.triangles.empty())
+    printf("%zu triangles, %zu vertices, bvh of %zu nodes and depth %d\n"
+        , world.triangles.size(), world.vertices.size()
+        , world.triangle_bvh.nodes.size(), world.triangle_bvh.get_depth());
+
+  if (opts.list_devices)
+    ocl_list_devices();
+  else if (opts.headless)
+    headless();
+  else {
+    g_screen = new screen("bblik", opts.width, opts.height);
+    if (opts.frame_budget > 0.f)
+      budget = new frame_budget(opts.frame_budget, opts.budget_resolution
+          , samples, bounces);
+    g_screen->mainloop(load, key_event, mouse_motion_event, mouse_button_event
+        , update, draw, cleanup);
+  }
 }
 
@@ -0,0 +1,147 @@
+#include "obj.hh"
+#include "utils.hh"
+#include <cstdio>
+#include <cstring>
+
+static inline bool is_space(char c) {
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline const char* skip_space(const char *p) {
+  while (is_space(*p))
+    ++p;
+  return p;
+}
+
+// good enough for geometry and several times faster than strtof
+static const char* parse_float(const char *p, float *result) {
+  p = skip_space(p);
+  bool negative = *p == '-';
+  if (*p == '-' || *p == '+')
+    ++p;
+  double value = 0;
+  while (*p >= '0' && *p <= '9')
+    value = value * 10 + (*p++ - '0');
+  if (*p == '.') {
+    ++p;
+    double scale = 0.1;
+    while (*p >= '0' && *p <= '9') {
+      value += (*p++ - '0') * scale;
+      scale *= 0.1;
+    }
+  }
+  if (*p == 'e' || *p == 'E') {
+    ++p;
+    bool negative_exponent = *p == '-';
+    if (*p == '-' || *p == '+')
+      ++p;
+    int exponent = 0;
+    while (*p >= '0' && *p <= '9')
+      exponent = exponent * 10 + (*p++ - '0');
+    double base = negative_exponent ? 0.1 : 10.;
+    while (exponent--)
+      value *= base;
+  }
+  *result = (float)(negative ? -value : value);
+  return p;
+}
+
+// parses the position index of a face vertex ("i", "i/t", "i//n" or
+// "i/t/n"). returns nullptr at the end of the line
+static const char* parse_face_vertex(const char *p, int num_vertices
+    , int *index) {
+  p = skip_space(p);
+  if (*p == '\n' || *p == 0)
+    return nullptr;
+  bool negative = *p == '-';
+  if (negative)
+    ++p;
+  int value = 0;
+  while (*p >= '0' && *p <= '9')
+    value = value * 10 + (*p++ - '0');
+  // indices start at 1, negative ones count back from the last vertex
+  *index = negative ? num_vertices - value : value - 1;
+  while (*p && !is_space(*p) && *p != '\n')
+    ++p;
+  return p;
+}
+
+size_t load_obj(const std::string &filename, int material
+    , std::vector<cl_float4> *vertices, std::vector<cl_int4> *triangles) {
+  FILE *f = fopen(filename.c_str(), "rb");
+  assertf(f, "failed to open file \"%s\"", filename.c_str());
+
+  size_t first_vertex = vertices->size(), first_triangle = triangles->size();
+  // the file is read in large chunks. a line cut off at the end of a chunk is
+  // moved to the front of the buffer and completed by the next read
+  const size_t chunk_size = 1 << 20;
+  std::vector<char> buffer(chunk_size + 1);
+  size_t kept = 0;
+  int line_number = 0;
+  for (;;) {
+    size_t read = fread(buffer.data() + kept, 1, chunk_size - kept, f);
+    size_t end = kept + read;
+    bool last = read == 0 || feof(f);
+    if (end == 0)
+      break;
+    buffer[end] = 0;
+
+    // only parse complete lines unless this is the end of the file
+    size_t parse_end = end;
+    if (!last) {
+      while (parse_end > 0 && buffer[parse_end - 1] != '\n')
+        --parse_end;
+      if (parse_end == 0)
+        die("line %d of \"%s\" is too long", line_number + 1
+            , filename.c_str());
+    }
+    char saved = buffer[parse_end];
+    buffer[parse_end] = 0;
+
+    const char *p = buffer.data();
+    while (*p) {
+      ++line_number;
+      p = skip_space(p);
+      if (p[0] == 'v' && is_space(p[1])) {
+        cl_float4 v;
+        p = parse_float(p + 1, &v.s[0]);
+        p = parse_float(p, &v.s[1]);
+        p = parse_float(p, &v.s[2]);
+        v.s[3] = 1.f;
+        vertices->push_back(v);
+      } else if (p[0] == 'f' && is_space(p[1])) {
+        int num_vertices = (int)(vertices->size() - first_vertex);
+        int first, previous, current, corners = 0;
+        const char *q = p + 1;
+        while ((q = parse_face_vertex(q, num_vertices, &current))) {
+          if (current < 0 || current >= num_vertices)
+            die("face at line %d of \"%s\" refers to a missing vertex"
+                , line_number, filename.c_str());
+          current += (int)first_vertex;
+          if (corners == 0)
+            first = current;
+          else if (corners >= 2)
+            triangles->push_back({{ first, previous, current, material }});
+          previous = current;
+          ++corners;
+        }
+        p = p + 1;
+      }
+      // skip the rest of the line
+      while (*p && *p != '\n')
+        ++p;
+      if (*p == '\n')
+        ++p;
+    }
+
+    if (last)
+      break;
+    buffer[parse_end] = saved;
+    kept = end - parse_end;
+    memmove(buffer.data(), buffer.data() + parse_end, kept);
+  }
+
+  fclose(f);
+  return triangles->size() - first_triangle;
+}
+
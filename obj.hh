@@ -0,0 +1,13 @@
+#pragma once
+
+#include <CL/cl.hpp>
+#include <string>
+#include <vector>
+
+// streams the vertices and faces of a Wavefront .obj file into indexed
+// triangles, appending them to `vertices` (xyz) and `triangles` (vertex
+// indices in xyz, `material` in w). polygons are split into fans, everything
+// but positions and faces is skipped. returns the number of triangles added
+size_t load_obj(const std::string &filename, int material
+    , std::vector<cl_float4> *vertices, std::vector<cl_int4> *triangles);
+
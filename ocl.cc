@@ -0,0 +1,280 @@
+#include "ocl.hh"
+#include "utils.hh"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+static std::string program_cache;
+static std::string extra_build_options;
+
+cl_device_type ocl_device_type(const std::string &name) {
+  if (name == "gpu")
+    return CL_DEVICE_TYPE_GPU;
+  if (name == "cpu")
+    return CL_DEVICE_TYPE_CPU;
+  return CL_DEVICE_TYPE_ALL;
+}
+
+static std::vector<cl::Device> get_devices(const cl::Platform &platform
+    , cl_device_type type) {
+  std::vector<cl::Device> devices;
+  // returns CL_DEVICE_NOT_FOUND instead of an empty list
+  if (platform.getDevices(type, &devices) != CL_SUCCESS)
+    devices.clear();
+  return devices;
+}
+
+void ocl_list_devices() {
+  std::vector<cl::Platform> platforms;
+  cl::Platform::get(&platforms);
+  for (size_t p = 0; p < platforms.size(); p++) {
+    printf("platform %zu: %s\n", p
+        , platforms[p].getInfo<CL_PLATFORM_NAME>().c_str());
+    std::vector<cl::Device> devices = get_devices(platforms[p]
+        , CL_DEVICE_TYPE_ALL);
+    for (size_t d = 0; d < devices.size(); d++) {
+      cl_device_type type = devices[d].getInfo<CL_DEVICE_TYPE>();
+      printf("  device %zu: %s (%s, %s)\n", d
+          , devices[d].getInfo<CL_DEVICE_NAME>().c_str()
+          , type & CL_DEVICE_TYPE_GPU ? "gpu"
+          : type & CL_DEVICE_TYPE_CPU ? "cpu" : "other"
+          , devices[d].getInfo<CL_DRIVER_VERSION>().c_str());
+    }
+  }
+}
+
+bool ocl_has_devices(cl_device_type type) {
+  std::vector<cl::Platform> platforms;
+  cl::Platform::get(&platforms);
+  for (const cl::Platform &platform : platforms)
+    if (!get_devices(platform, type).empty())
+      return true;
+  return false;
+}
+
+static std::string to_lower(std::string s) {
+  std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) {
+    return std::tolower(c);
+  });
+  return s;
+}
+
+static bool is_index(const std::string &spec) {
+  return !spec.empty() && std::all_of(spec.begin(), spec.end(), [](char c) {
+    return std::isdigit((unsigned char)c);
+  });
+}
+
+// does `spec` pick the `index`th entry named `name`?
+static bool spec_matches(const std::string &spec, size_t index
+    , const std::string &name) {
+  if (spec.empty())
+    return true;
+  if (is_index(spec))
+    return (size_t)std::stoul(spec) == index;
+  return to_lower(name).find(to_lower(spec)) != std::string::npos;
+}
+
+std::vector<ocl_device> ocl_select_devices(const std::string &platform_spec
+    , const std::string &device_spec, cl_device_type type) {
+  std::vector<cl::Platform> platforms;
+  cl::Platform::get(&platforms);
+  if (platforms.empty())
+    die("no OpenCL platforms found");
+
+  std::vector<ocl_device> candidates;
+  std::vector<size_t> indices;
+  for (size_t p = 0; p < platforms.size(); p++) {
+    if (!spec_matches(platform_spec, p
+          , platforms[p].getInfo<CL_PLATFORM_NAME>()))
+      continue;
+    std::vector<cl::Device> devices = get_devices(platforms[p], type);
+    for (size_t d = 0; d < devices.size(); d++) {
+      candidates.push_back({ platforms[p], devices[d] });
+      indices.push_back(d);
+    }
+  }
+
+  std::vector<ocl_device> selected;
+  if (device_spec == "all")
+    selected = candidates;
+  else {
+    std::vector<bool> taken(candidates.size(), false);
+    size_t begin = 0;
+    do {
+      size_t end = device_spec.find(',', begin);
+      std::string spec = device_spec.substr(begin, end == std::string::npos
+          ? std::string::npos : end - begin);
+      size_t c = 0;
+      for (; c < candidates.size(); c++)
+        if (!taken[c] && spec_matches(spec, indices[c]
+              , candidates[c].device.getInfo<CL_DEVICE_NAME>()))
+          break;
+      if (c == candidates.size())
+        die("no OpenCL device matches platform \"%s\", device \"%s\" and "
+            "the requested type (see --list-devices)", platform_spec.c_str()
+            , spec.c_str());
+      taken[c] = true;
+      selected.push_back(candidates[c]);
+      begin = end == std::string::npos ? end : end + 1;
+    } while (begin != std::string::npos);
+  }
+
+  if (selected.empty())
+    die("no OpenCL device of the requested type found (see --list-devices)");
+  return selected;
+}
+
+bool ocl_device_has_extension(const cl::Device &device
+    , const std::string &extension) {
+  std::string extensions = " " + device.getInfo<CL_DEVICE_EXTENSIONS>() + " ";
+  return extensions.find(" " + extension + " ") != std::string::npos;
+}
+
+void ocl_set_build_options(const std::string &options) {
+  extra_build_options = options;
+}
+
+void ocl_set_program_cache(const std::string &directory) {
+  program_cache = directory;
+}
+
+// 64-bit FNV-1a
+static unsigned long long int hash(const std::string &s) {
+  unsigned long long int h = 14695981039346656037ull;
+  for (char c : s) {
+    h ^= (unsigned char)c;
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+static std::string to_hex(unsigned long long int value) {
+  char hex[17];
+  snprintf(hex, sizeof(hex), "%016llx", value);
+  return hex;
+}
+
+// everything a binary depends on. a cache file starts with its key so that a
+// hash collision cannot load the wrong program
+static std::string cache_key(const cl::Device &device
+    , const std::string &source, const std::string &build_options) {
+  return "device " + device.getInfo<CL_DEVICE_NAME>() + "\n"
+    + "vendor " + device.getInfo<CL_DEVICE_VENDOR>() + "\n"
+    + "version " + device.getInfo<CL_DEVICE_VERSION>() + "\n"
+    + "driver " + device.getInfo<CL_DRIVER_VERSION>() + "\n"
+    + "options " + build_options + "\n"
+    + "source " + to_hex(hash(source)) + "\n";
+}
+
+static std::string cache_file(const std::string &key) {
+  return program_cache + "/" + to_hex(hash(key)) + ".bin";
+}
+
+// the binary cached under `key`, empty if there is none
+static std::vector<unsigned char> read_cached_binary(const std::string &key) {
+  std::vector<unsigned char> binary;
+  FILE *f = fopen(cache_file(key).c_str(), "rb");
+  if (!f)
+    return binary;
+  std::string file_key(key.size(), '\0');
+  if (fread(&file_key[0], 1, key.size(), f) == key.size() && file_key == key) {
+    unsigned char buffer[65536];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), f)) > 0)
+      binary.insert(binary.end(), buffer, buffer + read);
+  }
+  fclose(f);
+  return binary;
+}
+
+// creates `path` and its missing parents
+static bool make_directories(const std::string &path) {
+  for (size_t slash = path.find('/', 1); ; slash = path.find('/', slash + 1)) {
+    std::string dir = path.substr(0, slash);
+    if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+      return false;
+    if (slash == std::string::npos)
+      return true;
+  }
+}
+
+// several processes may build at once, so each writes a file of its own and
+// moves it into place
+static void write_cached_binary(const std::string &key
+    , const cl::Program &program) {
+  size_t size = 0;
+  if (clGetProgramInfo(program(), CL_PROGRAM_BINARY_SIZES, sizeof(size)
+        , &size, nullptr) != CL_SUCCESS || size == 0)
+    return;
+  std::vector<unsigned char> binary(size);
+  unsigned char *binaries[] = { binary.data() };
+  if (clGetProgramInfo(program(), CL_PROGRAM_BINARIES, sizeof(binaries)
+        , binaries, nullptr) != CL_SUCCESS)
+    return;
+  if (!make_directories(program_cache)) {
+    warning("cannot create the program cache %s", program_cache.c_str());
+    return;
+  }
+  std::string filename = cache_file(key)
+    , temporary = filename + "." + std::to_string(getpid());
+  FILE *f = fopen(temporary.c_str(), "wb");
+  if (!f) {
+    warning("cannot write %s", temporary.c_str());
+    return;
+  }
+  bool written = fwrite(key.data(), 1, key.size(), f) == key.size()
+    && fwrite(binary.data(), 1, size, f) == size;
+  written = fclose(f) == 0 && written;
+  if (!written || rename(temporary.c_str(), filename.c_str()) != 0)
+    remove(temporary.c_str());
+}
+
+cl::Program ocl_build_program(const cl::Context &context
+    , const cl::Device &device, const std::string &source
+    , const std::string &program_options, bool *failed) {
+  if (failed)
+    *failed = false;
+  std::string build_options = program_options;
+  if (!extra_build_options.empty())
+    build_options += " " + extra_build_options;
+  std::string key;
+  if (!program_cache.empty()) {
+    key = cache_key(device, source, build_options);
+    std::vector<unsigned char> binary = read_cached_binary(key);
+    if (!binary.empty()) {
+      // a binary the driver turns down just means compiling from source
+      cl::Program::Binaries binaries(1
+          , std::make_pair((const void*)binary.data(), binary.size()));
+      std::vector<cl_int> status;
+      cl_int err;
+      cl::Program program(context, { device }, binaries, &status, &err);
+      if (err == CL_SUCCESS && !status.empty() && status[0] == CL_SUCCESS
+          && program.build({ device }, build_options.c_str()) == CL_SUCCESS)
+        return program;
+    }
+  }
+
+  cl::Program program = cl::Program(context, source);
+  cl_int result = program.build({ device }, build_options.c_str());
+  if (result) {
+    if (result == CL_BUILD_PROGRAM_FAILURE) {
+      std::string build_log
+        = program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device);
+      printf("Build log:\n%s\n", build_log.c_str());
+    }
+    if (!failed)
+      die("Failed to compile OpenCL program (%d)", result);
+    warning("failed to compile OpenCL program (%d)", result);
+    *failed = true;
+    return cl::Program();
+  }
+  if (!program_cache.empty())
+    write_cached_binary(key, program);
+  return program;
+}
+
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <CL/cl.hpp>
+#include <string>
+#include <vector>
+
+struct ocl_device {
+  cl::Platform platform;
+  cl::Device device;
+};
+
+cl_device_type ocl_device_type(const std::string &name);
+void ocl_list_devices();
+// whether any platform has a device of the given type. false without any
+// OpenCL platforms installed
+bool ocl_has_devices(cl_device_type type);
+// platform_spec and device_spec are either an index or a case-insensitive
+// part of the name. empty specs pick the first platform that has a device of
+// the requested type and the first such device on it. device_spec can also be
+// a comma separated list of such specs, each picking the first matching
+// device not already picked, or "all" for every matching device
+std::vector<ocl_device> ocl_select_devices(const std::string &platform_spec
+    , const std::string &device_spec, cl_device_type type);
+bool ocl_device_has_extension(const cl::Device &device
+    , const std::string &extension);
+// builds from the binary cache when it has the program for this device,
+// driver, options and source, and from source otherwise. a failed build
+// dies, unless `failed` is given: it is set and the program returned empty
+cl::Program ocl_build_program(const cl::Context &context
+    , const cl::Device &device, const std::string &source
+    , const std::string &build_options, bool *failed = nullptr);
+// options ocl_build_program() adds to those of every program, such as
+// -cl-fast-relaxed-math
+void ocl_set_build_options(const std::string &options);
+// directory ocl_build_program() keeps compiled programs in, created when
+// needed. empty turns the cache off
+void ocl_set_program_cache(const std::string &directory);
+
@@ -2,17 +2,52 @@ __constant float EPSILON = 0.00003f;
 __constant float PI = 3.14159265358979323846f;
 __constant float inf = 1e20f;
 
+// enough for any bvh the host builds, see bvh::max_depth
+#define BVH_STACK_SIZE 64
+
 typedef struct {
   float3 origin;
   float3 dir;
 } Ray;
 
 typedef struct {
-  float radius;
-  float3 pos;
   float3 color;
   float3 emission;
-} Sphere;
+} Material;
+
+// everything a ray can hit. spheres and triangles have a bvh each. spheres
+// are their centre in xyz and squared radius in w, with their materials
+// apart, triangles three vertex indices plus a material index
+typedef struct {
+  __global const float4 *spheres;
+  __global const Material *sphere_materials;
+  // a copy of the spheres in local memory when there are few enough of them
+  // (num_local_spheres > 0), so that the inner loop of the traversal does
+  // not go out to global memory
+  __local const float4 *local_spheres;
+  int num_local_spheres;
+  __global const float4 *sphere_nodes;
+  __global const int *sphere_indices;
+  __global const float4 *vertices;
+  __global const int4 *triangles;
+  __global const Material *materials;
+  __global const float4 *triangle_nodes;
+  __global const int *triangle_indices;
+  int num_triangles;
+  // emissive spheres sampled by next event estimation, none turns it off
+  __global const int *lights;
+  int num_lights;
+  // rays traced, only counted by builds with COUNT_RAYS
+  __global uint *ray_count;
+  // what SAMPLER_BLUE_NOISE shifts its points by, see sample_2d()
+  __global const float *blue_noise;
+} Scene;
+
+#ifdef COUNT_RAYS
+#define count_ray(scene) atomic_inc((scene)->ray_count)
+#else
+#define count_ray(scene)
+#endif
 
 uint wang_hash(uint seed) {
   seed = (seed ^ 61) ^ (seed >> 16);
@@ -34,11 +69,141 @@ float random(uint *rng_state) {
   return (float)(rand_xorshift(rng_state)) * (1.0 / 4294967296.0);
 }
 
+// samplers, where paths get their random numbers from, picked by SAMPLER:
+// - SAMPLER_RANDOM: xorshift, white noise
+// - SAMPLER_SOBOL: the first two dimensions of the Sobol sequence with Owen
+//   scrambling, a differently shuffled and scrambled copy for every pair of
+//   dimensions a path draws (padding) and pixel
+// - SAMPLER_BLUE_NOISE: the same points for every pixel, shifted
+//   toroidally by a blue noise tile, a differently placed one for every
+//   dimension. neighbouring pixels get points far apart, which puts the
+//   error of low sample counts into high frequencies
+// the sobol samplers need the number of the sample in the pixel's sequence,
+// which is how many samples it has accumulated before
+#define SAMPLER_RANDOM 0
+#define SAMPLER_SOBOL 1
+#define SAMPLER_BLUE_NOISE 2
+#ifndef SAMPLER
+#define SAMPLER SAMPLER_BLUE_NOISE
+#endif
+
+typedef struct {
+  uint state; // of xorshift, or the seed of the scrambling
+  uint index; // of the sample in the pixel's sequence
+  uint dimension; // pair of dimensions drawn next
+  uint texel; // of the pixel in the blue noise tile, y * BLUE_NOISE_SIZE + x
+} Sampler;
+
+// the sobol samplers draw from one of many independently scrambled
+// sequences, picked by `sequence`. the random one takes a new one with every
+// `frame` anyway
+Sampler make_sampler(const int x, const int y, const int width
+    , const uint frame, const uint sequence) {
+  Sampler s;
+  uint scramble = sequence ? wang_hash(sequence) : 0;
+#if SAMPLER == SAMPLER_RANDOM
+  s.state = wang_hash(wang_hash(frame) ^ (y * width + x));
+#elif SAMPLER == SAMPLER_SOBOL
+  s.state = wang_hash(y * width + x) ^ scramble;
+#else
+  s.state = scramble;
+#endif
+  s.index = 0;
+  s.dimension = 0;
+  s.texel = y % BLUE_NOISE_SIZE * BLUE_NOISE_SIZE + x % BLUE_NOISE_SIZE;
+  return s;
+}
+
+// starts drawing the dimensions of sample `index` of the pixel
+void start_sample(Sampler *s, const uint index) {
+  s->index = index;
+  s->dimension = 0;
+}
+
+uint reverse_bits(uint x) {
+  x = (x << 16) | (x >> 16);
+  x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+  x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+  x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+  x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+  return x;
+}
+
+uint hash_combine(const uint seed, const uint v) {
+  return seed ^ (v + (seed << 6) + (seed >> 2));
+}
+
+// Owen scrambling of the bits of `x` taken as a binary fraction, every bit
+// flipped or not depending on the bits above it. a hash that only mixes bits
+// into higher ones (Laine and Karras) does that on the reversed bits, with
+// the constants of Burley's "Practical Hash-based Owen Scrambling"
+uint nested_uniform_scramble(uint x, const uint seed) {
+  x = reverse_bits(x);
+  x += seed;
+  x ^= x * 0x6c50b47cu;
+  x ^= x * 0xb82f1e52u;
+  x ^= x * 0xc7afe638u;
+  x ^= x * 0x8d22f6e6u;
+  return reverse_bits(x);
+}
+
+// second dimension of the Sobol sequence, the first is reverse_bits(i)
+uint sobol_1(uint i) {
+  uint x = 0;
+  for (uint v = 1u << 31; i; i >>= 1, v ^= v >> 1)
+    if (i & 1)
+      x ^= v;
+  return x;
+}
+
+float bits_to_float(const uint x) {
+  return (float)(x >> 8) * (1.f / 16777216.f);
+}
+
+// the pixel's value in the blue noise tile moved by step `k` of the R2
+// sequence, which keeps the values of different steps unrelated
+float blue_noise_at(__global const float *blue_noise, const uint texel
+    , const uint k) {
+  float2 step = (float)k * (float2)(0.7548776662f, 0.5698402910f);
+  int2 offset = convert_int2((step - floor(step)) * (float)BLUE_NOISE_SIZE);
+  int x = (texel % BLUE_NOISE_SIZE + offset.x) % BLUE_NOISE_SIZE
+    , y = (texel / BLUE_NOISE_SIZE + offset.y) % BLUE_NOISE_SIZE;
+  return blue_noise[y * BLUE_NOISE_SIZE + x];
+}
+
+// the next two dimensions of the sample in [0, 1)
+float2 sample_2d(Sampler *s, __global const float *blue_noise) {
+#if SAMPLER == SAMPLER_RANDOM
+  float u = random(&s->state);
+  return (float2)(u, random(&s->state));
+#else
+  uint seed = hash_combine(s->state, wang_hash(s->dimension));
+  uint index = nested_uniform_scramble(s->index, seed);
+  float2 u = (float2)(
+      bits_to_float(nested_uniform_scramble(reverse_bits(index)
+          , hash_combine(seed, 1)))
+      , bits_to_float(nested_uniform_scramble(sobol_1(index)
+          , hash_combine(seed, 2))));
+#if SAMPLER == SAMPLER_BLUE_NOISE
+  u += (float2)(blue_noise_at(blue_noise, s->texel, 2 * s->dimension + 1)
+      , blue_noise_at(blue_noise, s->texel, 2 * s->dimension + 2));
+  u -= floor(u);
+#endif
+  s->dimension++;
+  return u;
+#endif
+}
+
+float sample_1d(Sampler *s, __global const float *blue_noise) {
+  return sample_2d(s, blue_noise).x;
+}
+
+// `jitter` is where in the pixel the ray goes through, in [0, 1)^2
 Ray create_cam_ray(const int x_coord, const int y_coord, const int width
-    , const int height) {
+    , const int height, const float3 cam_pos, const float2 jitter) {
   // convert int in range [0 - width] to float in range [0-1]
-  float fx = (float)x_coord / (float)width;
-  float fy = (float)y_coord / (float)height;
+  float fx = ((float)x_coord + jitter.x) / (float)width;
+  float fy = ((float)y_coord + jitter.y) / (float)height;
 
   // calculate aspect ratio
   float aspect_ratio = (float)width / (float)height;
@@ -51,18 +216,17 @@ Ray create_cam_ray(const int x_coord, const int y_coord, const int width
   // create camera ray with fixed camera position and
   // vector from camera to pixel on screen
   Ray ray;
-  ray.origin = (float3)(0.f, 0.1f, 2.f);
+  ray.origin = cam_pos;
   ray.dir = normalize(pixel_pos - ray.origin);
 
   return ray;
 }
 
-// (__global Sphere* sphere, const Ray* ray)
-// version using local copy of sphere
-float intersect_sphere(const Sphere *sphere, const Ray *ray) {
-  float3 ray_to_center = sphere->pos - ray->origin;
+// `sphere` is the centre in xyz and the squared radius in w
+float intersect_sphere(const float4 sphere, const Ray *ray) {
+  float3 ray_to_center = sphere.xyz - ray->origin;
   float b = dot(ray_to_center, ray->dir);
-  float c = dot(ray_to_center, ray_to_center) - sphere->radius * sphere->radius;
+  float c = dot(ray_to_center, ray_to_center) - sphere.w;
   float disc = b * b - c;
 
   if (disc < 0.f)
@@ -78,93 +242,352 @@ float intersect_sphere(const Sphere *sphere, const Ray *ray) {
   return 0.f;
 }
 
-bool intersect_scene(__constant Sphere *spheres, const Ray *ray, float *t
-    , int *sphere_id, const int num_spheres) {
-  *t = inf;
+// moller-trumbore, two sided. 0 on a miss like intersect_sphere
+float intersect_triangle(const float3 v0, const float3 v1, const float3 v2
+    , const Ray *ray) {
+  float3 e1 = v1 - v0, e2 = v2 - v0;
+  float3 p = cross(ray->dir, e2);
+  float det = dot(e1, p);
+  if (fabs(det) < 1e-12f)
+    return 0.f; // parallel to the triangle
+  float inv_det = 1.f / det;
+
+  float3 s = ray->origin - v0;
+  float u = dot(s, p) * inv_det;
+  if (u < 0.f || u > 1.f)
+    return 0.f;
+  float3 q = cross(s, e1);
+  float v = dot(ray->dir, q) * inv_det;
+  if (v < 0.f || u + v > 1.f)
+    return 0.f;
+
+  float t = dot(e2, q) * inv_det;
+  return t > EPSILON ? t : 0.f;
+}
+
+// distance at which the ray enters box `node` of the bvh, inf if it misses it
+// or only gets there after `t_max`. nodes are pairs of float4s: min and max
+// corners in xyz, child or primitive index and primitive count in w
+float intersect_node(__global const float4 *bvh_nodes, const int node
+    , const Ray *ray, const float3 inv_dir, const float t_max) {
+  float3 t0 = (bvh_nodes[2 * node].xyz - ray->origin) * inv_dir;
+  float3 t1 = (bvh_nodes[2 * node + 1].xyz - ray->origin) * inv_dir;
+  float3 t_min = fmin(t0, t1), t_max3 = fmax(t0, t1);
+  float t_enter = fmax(fmax(t_min.x, t_min.y), t_min.z);
+  float t_exit = fmin(fmin(t_max3.x, t_max3.y), fmin(t_max3.z, t_max));
+  return t_enter <= t_exit && t_exit > 0.f ? t_enter : inf;
+}
+
+float4 sphere_at(const Scene *scene, const int id) {
+  return scene->num_local_spheres > 0 ? scene->local_spheres[id]
+    : scene->spheres[id];
+}
+
+float intersect_primitive(const Scene *scene, const bool triangles
+    , const int id, const Ray *ray) {
+  if (triangles) {
+    int4 tri = scene->triangles[id];
+    return intersect_triangle(scene->vertices[tri.x].xyz
+        , scene->vertices[tri.y].xyz, scene->vertices[tri.z].xyz, ray);
+  }
+  return intersect_sphere(sphere_at(scene, id), ray);
+}
+
+// walks a bvh front to back, descending into the nearer child first and
+// keeping the farther one on a short stack. only hits closer than `t` count,
+// `hit_id` is left alone when there are none. with `any_hit` it stops at the
+// first hit found, which is all shadow rays need to know
+void intersect_bvh(const Scene *scene, const bool triangles
+    , __global const float4 *bvh_nodes, __global const int *bvh_indices
+    , const Ray *ray, const float3 inv_dir, const bool any_hit, float *t
+    , int *hit_id) {
+  int stack[BVH_STACK_SIZE];
+  int stack_size = 0;
+  int node = 0;
 
-  for (int i = 0; i < num_spheres; i++) {
-    Sphere sphere = spheres[i]; // create local copy of sphere
-    // float hitdistance = intersect_sphere(&spheres[i], ray);
-    float hitdistance = intersect_sphere(&sphere, ray);
-    // keep track of the closest intersection and hitobject found so far
-    if (hitdistance != 0.f && hitdistance < *t) {
-      *t = hitdistance;
-      *sphere_id = i;
+  if (intersect_node(bvh_nodes, node, ray, inv_dir, *t) == inf)
+    return;
+
+  for (;;) {
+    int left_first = as_int(bvh_nodes[2 * node].w);
+    int count = as_int(bvh_nodes[2 * node + 1].w);
+
+    if (count > 0) {
+      for (int i = left_first; i < left_first + count; i++) {
+        int id = bvh_indices[i];
+        float hitdistance = intersect_primitive(scene, triangles, id, ray);
+        // keep track of the closest intersection and hitobject found so far
+        if (hitdistance != 0.f && hitdistance < *t) {
+          *t = hitdistance;
+          *hit_id = triangles ? ~id : id;
+          if (any_hit)
+            return;
+        }
+      }
+    } else {
+      int near = left_first, far = left_first + 1;
+      float t_near = intersect_node(bvh_nodes, near, ray, inv_dir, *t);
+      float t_far = intersect_node(bvh_nodes, far, ray, inv_dir, *t);
+      if (t_far < t_near) {
+        int tmp = near;
+        near = far;
+        far = tmp;
+        float tmp_t = t_near;
+        t_near = t_far;
+        t_far = tmp_t;
+      }
+      if (t_near < inf) {
+        if (t_far < inf)
+          stack[stack_size++] = far;
+        node = near;
+        continue;
+      }
     }
+
+    // next node from the stack that can still hold a closer hit
+    do {
+      if (stack_size == 0)
+        return;
+      node = stack[--stack_size];
+    } while (intersect_node(bvh_nodes, node, ray, inv_dir, *t) == inf);
   }
+}
+
+// 1 / dir for the box tests, with zero components made huge instead of
+// infinite. a ray lying in the plane of a box face would get 0 * inf = nan
+// there and miss the box, leaving a seam wherever it touches a mesh
+float3 inv_direction(const float3 dir) {
+  return (float3)(fabs(dir.x) > 1e-30f ? 1.f / dir.x : 1e30f
+      , fabs(dir.y) > 1e-30f ? 1.f / dir.y : 1e30f
+      , fabs(dir.z) > 1e-30f ? 1.f / dir.z : 1e30f);
+}
+
+// closest hit among spheres and triangles. `hit_id` is the index of a sphere
+// or, for triangles, the bitwise complement of the triangle index
+bool intersect_scene(const Scene *scene, const Ray *ray, float *t
+    , int *hit_id) {
+  count_ray(scene);
+  *t = inf;
+  float3 inv_dir = inv_direction(ray->dir);
+  intersect_bvh(scene, false, scene->sphere_nodes, scene->sphere_indices, ray
+      , inv_dir, false, t, hit_id);
+  if (scene->num_triangles > 0)
+    intersect_bvh(scene, true, scene->triangle_nodes, scene->triangle_indices
+        , ray, inv_dir, false, t, hit_id);
   return *t < inf; // true when ray interesects the scene
 }
 
+// whether anything is in the way of `ray` before `t_max`
+bool occluded(const Scene *scene, const Ray *ray, const float t_max) {
+  count_ray(scene);
+  float t = t_max;
+  int hit_id;
+  float3 inv_dir = inv_direction(ray->dir);
+  intersect_bvh(scene, false, scene->sphere_nodes, scene->sphere_indices, ray
+      , inv_dir, true, &t, &hit_id);
+  if (t == t_max && scene->num_triangles > 0)
+    intersect_bvh(scene, true, scene->triangle_nodes, scene->triangle_indices
+        , ray, inv_dir, true, &t, &hit_id);
+  return t < t_max;
+}
+
+// geometric normal and material at `hitpoint` on what intersect_scene hit
+void surface_at(const Scene *scene, const int hit_id, const float3 hitpoint
+    , float3 *normal, float3 *color, float3 *emission) {
+  if (hit_id >= 0) {
+    *normal = normalize(hitpoint - sphere_at(scene, hit_id).xyz);
+    Material material = scene->sphere_materials[hit_id];
+    *color = material.color;
+    *emission = material.emission;
+  } else {
+    int4 tri = scene->triangles[~hit_id];
+    float3 v0 = scene->vertices[tri.x].xyz;
+    *normal = normalize(cross(scene->vertices[tri.y].xyz - v0
+          , scene->vertices[tri.z].xyz - v0));
+    Material material = scene->materials[tri.w];
+    *color = material.color;
+    *emission = material.emission;
+  }
+}
+
+float3 background() {
+  return (float3)(0.15f, 0.15f, 0.25f);
+}
+
+// local orthogonal coordinate frame around `w`
+void make_frame(const float3 w, float3 *u, float3 *v) {
+  float3 axis = fabs(w.x) > EPSILON ? (float3)(0.f, 1.f, 0.f)
+    : (float3)(1.f, 0.f, 0.f);
+  *u = normalize(cross(axis, w));
+  *v = cross(w, *u);
+}
+
+// 1 - cos of the half angle of the cone `light` subtends from `p`, 0 when `p`
+// is inside. written so that it stays accurate for small, far away lights
+float sphere_cone_width(const float4 light, const float3 p, float3 *to_light
+    , float *dist2) {
+  *to_light = light.xyz - p;
+  *dist2 = dot(*to_light, *to_light);
+  float sin2_max = light.w / *dist2;
+  if (sin2_max >= 1.f)
+    return 0.f;
+  return sin2_max / (1.f + sqrt(1.f - sin2_max));
+}
+
+// solid angle density of sampling `light` from `p` uniformly over its cone
+float sphere_cone_pdf(const float4 light, const float3 p) {
+  float3 to_light;
+  float dist2;
+  float width = sphere_cone_width(light, p, &to_light, &dist2);
+  return width > 0.f ? 1.f / (2.f * PI * width) : 0.f;
+}
+
+// direction from `p` uniformly inside the cone of `light` for the sample
+// `r`, returns its density or 0 when there is none
+float sample_sphere_cone(const float4 light, const float3 p, float3 *dir
+    , const float2 r) {
+  float3 to_light;
+  float dist2;
+  float width = sphere_cone_width(light, p, &to_light, &dist2);
+  if (width <= 0.f)
+    return 0.f;
+  float cos_theta = 1.f - r.x * width;
+  float sin_theta = sqrt(max(0.f, 1.f - cos_theta * cos_theta));
+  float phi = 2.f * PI * r.y;
+  float3 w = to_light * rsqrt(dist2), u, v;
+  make_frame(w, &u, &v);
+  *dir = normalize(u * cos(phi) * sin_theta + v * sin(phi) * sin_theta
+      + w * cos_theta);
+  return 1.f / (2.f * PI * width);
+}
+
+float power_heuristic(const float pdf, const float other_pdf) {
+  return pdf * pdf / (pdf * pdf + other_pdf * other_pdf);
+}
+
+// one step of a path at the surface `ray` hit after `t`: adds the light
+// emitted there and light from an emissive sphere sampled directly (next
+// event estimation), then reflects the ray in a random direction (by randomly
+// sampling the hemisphere above the hitpoint). `pdf` is the density the ray
+// was sampled with, 0 for camera rays. both ways of finding light are
+// weighted by multiple importance sampling. there is no light sampling on
+// the `last` bounce. it would find light that a path of this length cannot
+// reach. the diffuse response has always been albedo * cos / pi here. the
+// cosine of the outgoing direction goes into the mask on top of the
+// cosine-weighted sampling, and light sampling keeps it that way.
+// returns false once `mask` is black and the path cannot add anything anymore
+bool diffuse_bounce(const Scene *scene, const int hit_id, const float t
+    , const bool last, Ray *ray, float3 *mask, float *pdf, float3 *accum_color
+    , Sampler *sampler) {
+  // compute the hitpoint using the ray equation
+  float3 hitpoint = ray->origin + ray->dir * t;
+
+  // fetch the surface there, then flip the normal if necessary to face the
+  // incoming ray
+  float3 normal, color, emission;
+  surface_at(scene, hit_id, hitpoint, &normal, &color, &emission);
+  float3 normal_facing = dot(normal, ray->dir) < 0.f ? normal : normal * (-1.f);
+
+  // add the light contribution, reduced when light sampling from the
+  // previous hitpoint could have found it as well
+  float weight = 1.f;
+  // (the host lists every emissive sphere as a light)
+  if (scene->num_lights > 0 && *pdf > 0.f && hit_id >= 0
+      && (emission.x > 0.f || emission.y > 0.f || emission.z > 0.f)) {
+    weight = power_heuristic(*pdf, sphere_cone_pdf(sphere_at(scene, hit_id)
+          , ray->origin) / scene->num_lights);
+  }
+  *accum_color += *mask * emission * weight;
+
+  // add a very small offset to the hitpoint to prevent self intersection
+  float3 origin = hitpoint + normal_facing * EPSILON;
+
+  // next event estimation: sample a light and add what it gives unless
+  // something is in the way
+  if (scene->num_lights > 0 && !last) {
+    int l = min((int)(sample_1d(sampler, scene->blue_noise)
+          * scene->num_lights)
+        , scene->num_lights - 1);
+    int light_id = scene->lights[l];
+    float4 light = sphere_at(scene, light_id);
+    Ray shadow_ray;
+    shadow_ray.origin = origin;
+    float light_pdf = sample_sphere_cone(light, origin, &shadow_ray.dir
+        , sample_2d(sampler, scene->blue_noise)) / scene->num_lights;
+    float cos_light = dot(shadow_ray.dir, normal_facing);
+    float t_light = light_pdf > 0.f && cos_light > 0.f
+      ? intersect_sphere(light, &shadow_ray) : 0.f;
+    // the margin keeps the light itself from counting as an occluder. it is
+    // absolute since anything closer to the light than it leaks through
+    if (t_light > 0.f && !occluded(scene, &shadow_ray, t_light - EPSILON)) {
+      float bsdf_pdf = cos_light / PI;
+      *accum_color += *mask * color
+        * scene->sphere_materials[light_id].emission * cos_light * bsdf_pdf
+        / light_pdf * power_heuristic(light_pdf, bsdf_pdf);
+    }
+  }
+
+  // compute two random numbers to pick a random point on the hemisphere above
+  // the hitpoint
+  float2 r = sample_2d(sampler, scene->blue_noise);
+  float rand1 = 2.f * PI * r.x;
+  float rand2 = r.y;
+  float rand2s = sqrt(rand2);
+
+  // create a local orthogonal coordinate frame centered at the hitpoint
+  float3 w = normal_facing, u, v;
+  make_frame(w, &u, &v);
+
+  // use the coordinte frame and random numbers to compute the next ray
+  // direction
+  float3 newdir = normalize(u * cos(rand1) * rand2s + v * sin(rand1) * rand2s
+      + w * sqrt(1.f - rand2));
+
+  ray->origin = origin;
+  ray->dir = newdir;
+
+  // the mask colour picks up surface colours at each bounce
+  *mask *= color;
+
+  // perform cosine-weighted importance sampling for diffuse surfaces
+  *mask *= dot(newdir, normal_facing);
+  *pdf = dot(newdir, normal_facing) / PI;
+
+  return mask->x > 0.f || mask->y > 0.f || mask->z > 0.f;
+}
+
 // the path tracing function
 // computes a path (starting from the camera) with a defined number of bounces,
 // accumulates light/color at each bounce. each ray hitting a surface will be
-// reflected in a random direction (by randomly sampling the hemisphere above
-// the hitpoint)
+// reflected in a random direction
 // small optimisation: diffuse ray directions are calculated using cosine
 // weighted importance sampling
-float3 trace(const int bounces, __constant Sphere *spheres
-    , const int num_spheres, const Ray *camray, uint *rng_state) {
+float3 trace(const int bounces, const Scene *scene, const Ray *camray
+    , Sampler *sampler) {
   Ray ray = *camray;
 
   float3 accum_color = (float3)(0.f, 0.f, 0.f);
   float3 mask = (float3)(1.f, 1.f, 1.f);
+  float pdf = 0.f;
 
   for (int bounce = 0; bounce < bounces; bounce++) {
     float t; // distance to intersection
-    int hitsphere_id = 0; // index of intersected sphere
+    int hit_id = 0; // sphere or triangle that was hit
 
     // if ray misses scene, return background colour
-    if (!intersect_scene(spheres, &ray, &t, &hitsphere_id, num_spheres))
-      return accum_color += mask * (float3)(0.15f, 0.15f, 0.25f);
-
-    // else, we've got a hit! Fetch the closest hit sphere
-    // version with local copy of sphere
-    Sphere hitsphere = spheres[hitsphere_id];
-
-    // compute the hitpoint using the ray equation
-    float3 hitpoint = ray.origin + ray.dir * t;
-
-    // compute the surface normal and flip it if necessary to face the
-    // incoming ray
-    float3 normal = normalize(hitpoint - hitsphere.pos);
-    float3 normal_facing = dot(normal, ray.dir) < 0.f ? normal : normal * (-1.f);
-
-    // compute two random numbers to pick a random point on the hemisphere above
-    // the hitpoint
-    float rand1 = 2.f * PI * random(rng_state);
-    float rand2 = random(rng_state);
-    float rand2s = sqrt(rand2);
+    if (!intersect_scene(scene, &ray, &t, &hit_id))
+      return accum_color += mask * background();
 
-    // create a local orthogonal coordinate frame centered at the hitpoint
-    float3 w = normal_facing;
-    float3 axis = fabs(w.x) > EPSILON ? (float3)(0.f, 1.f, 0.f)
-      : (float3)(1.f, 0.f, 0.f);
-    float3 u = normalize(cross(axis, w));
-    float3 v = cross(w, u);
-
-    // use the coordinte frame and random numbers to compute the next ray
-    // direction
-    float3 newdir = normalize(u * cos(rand1) * rand2s + v * sin(rand1) * rand2s
-        + w * sqrt(1.f - rand2));
-
-    // add a very small offset to the hitpoint to prevent self intersection
-    ray.origin = hitpoint + normal_facing * EPSILON;
-    ray.dir = newdir;
-
-    // add the colour and light contributions to the accumulated colour
-    accum_color += mask * hitsphere.emission;
-
-    // the mask colour picks up surface colours at each bounce
-    mask *= hitsphere.color;
-
-    // perform cosine-weighted importance sampling for diffuse surfaces
-    mask *= dot(newdir, normal_facing);
+    // else, we've got a hit!
+    if (!diffuse_bounce(scene, hit_id, t, bounce == bounces - 1, &ray, &mask
+          , &pdf, &accum_color, sampler))
+      break;
 
 #if 0
     // R.R.
     if (bounce > 3) {
       float p = max(mask.x, max(mask.y, mask.z));
-      if (random(rng_state) > p)
+      if (sample_1d(sampler, scene->blue_noise) > p)
         break;
       mask *= 1.f / p;
     }
@@ -174,6 +597,12 @@ float3 trace(const int bounces, __constant Sphere *spheres
   return accum_color;
 }
 
+// with OpenGL interop the image is linear radiance in a half float texture,
+// which screen.frag exposes, tone maps and encodes for display. devices
+// without interop write the same half floats into a buffer that is copied to
+// the texture. without a texture at all the image goes into a plain rgba8
+// buffer as sRGB instead, for reading back
+#ifdef OUTPUT_BUFFER
 float linear_to_srgb(float x) {
   if (x < 0.0031308f)
     x *= 12.92f;
@@ -191,28 +620,655 @@ float4 linear_to_srgb_clamp4(float3 c) {
       , linear_to_srgb_clamp(c.z), 1.f);
 }
 
-__kernel void render_kernel(const int samples, const int bounces
-    , __constant Sphere *spheres, const int num_spheres
-    , write_only image2d_t out, const int width, const int height) {
-  // the unique global id of the work item for the current pixel
-  unsigned int work_item_id = get_global_id(0);
+#define OUTPUT_TYPE __global uchar4 *
+#define write_output(out, x, y, width, c) \
+  ((out)[(y) * (width) + (x)] \
+   = convert_uchar4_sat_rte(linear_to_srgb_clamp4(c) * 255.f))
+#elif defined(OUTPUT_HALF)
+#define OUTPUT_TYPE __global half *
+#define write_output(out, x, y, width, c) \
+  vstore_half4((float4)((c), 1.f), (y) * (width) + (x), (out))
+#else
+#define OUTPUT_TYPE write_only image2d_t
+#define write_output(out, x, y, width, c) \
+  write_imagef((out), (int2)((x), (y)), (float4)((c), 1.f))
+#endif
+
+// copies the first `count` spheres into local memory, all work items of the
+// group together. all of them have to get here
+__local const float4* stage_spheres(__local float4 *local_spheres
+    , __global const float4 *spheres, const int count) {
+  if (count > 0) {
+    event_t copied = async_work_group_copy(local_spheres, spheres, count, 0);
+    wait_group_events(1, &copied);
+  }
+  return local_spheres;
+}
+
+// what every kernel that traces rays gets passed, and how it turns that into
+// a Scene. SCENE_INIT stages the spheres in local memory, so it comes before
+// any work item returns
+#define SCENE_PARAMS \
+  __global const float4 *spheres, __global const Material *sphere_materials \
+  , const int num_spheres, __local float4 *local_spheres \
+  , const int num_local_spheres \
+  , __global const float4 *sphere_nodes, __global const int *sphere_indices \
+  , __global const float4 *vertices, __global const int4 *triangles \
+  , __global const Material *materials, const int num_triangles \
+  , __global const float4 *triangle_nodes \
+  , __global const int *triangle_indices, __global const int *lights \
+  , const int num_lights, __global uint *ray_count \
+  , __global const float *blue_noise
+
+#define SCENE_INIT(scene) \
+  scene.spheres = spheres; \
+  scene.sphere_materials = sphere_materials; \
+  scene.local_spheres = stage_spheres(local_spheres, spheres \
+      , num_local_spheres); \
+  scene.num_local_spheres = num_local_spheres; \
+  scene.sphere_nodes = sphere_nodes; \
+  scene.sphere_indices = sphere_indices; \
+  scene.vertices = vertices; \
+  scene.triangles = triangles; \
+  scene.materials = materials; \
+  scene.triangle_nodes = triangle_nodes; \
+  scene.triangle_indices = triangle_indices; \
+  scene.num_triangles = num_triangles; \
+  scene.lights = lights; \
+  scene.num_lights = num_lights; \
+  scene.ray_count = ray_count; \
+  scene.blue_noise = blue_noise
+
+float luminance(const float3 c) {
+  return dot(c, (float3)(0.2126f, 0.7152f, 0.0722f));
+}
+
+// adds `samples` samples with radiance `sum` and sum of squared luminances
+// `sum_l2` to a pixel. `moments` keeps the latter for estimating variance
+float4 accumulate(__global float4 *accum, __global float *moments
+    , const int pixel, const float3 sum, const float sum_l2, const int samples
+    , const int reset) {
+  float4 acc = reset ? (float4)(0.f, 0.f, 0.f, 0.f) : accum[pixel];
+  acc += (float4)(sum, (float)samples);
+  accum[pixel] = acc;
+  moments[pixel] = (reset ? 0.f : moments[pixel]) + sum_l2;
+  return acc;
+}
+
+#if (TILE_SIZE & (TILE_SIZE - 1)) != 0
+#error "TILE_SIZE has to be a power of two"
+#endif
+
+// the even bits of `m` packed together, a coordinate of the Morton code `m`
+int morton_coordinate(uint m) {
+  m &= 0x55555555;
+  m = (m | (m >> 1)) & 0x33333333;
+  m = (m | (m >> 2)) & 0x0f0f0f0f;
+  m = (m | (m >> 4)) & 0x00ff00ff;
+  m = (m | (m >> 8)) & 0x0000ffff;
+  return (int)m;
+}
+
+// pixel of work item `i` of a launch. launches go over TILE_SIZE^2 tiles: all
+// those `region` touches, row by row, or with adaptive sampling
+// (`num_tiles` > 0) the listed ones. within a tile the pixels follow the
+// Morton curve, so that every aligned power of two run of work items, like a
+// work group or the SIMD width of a GPU, gets a compact block of pixels whose
+// rays take similar paths through the scene. false for items left over or
+// outside the region
+bool launch_pixel(const int i, const int4 region, __global const int *tiles
+    , const int num_tiles, const int width, int *x, int *y) {
+  int tile = i / (TILE_SIZE * TILE_SIZE), tile_x, tile_y;
+  if (num_tiles > 0) {
+    if (tile >= num_tiles)
+      return false;
+    int tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+    tile_x = tiles[tile] % tiles_x;
+    tile_y = tiles[tile] / tiles_x;
+  } else {
+    int first_x = region.x / TILE_SIZE, first_y = region.y / TILE_SIZE;
+    int region_tiles_x = (region.z + TILE_SIZE - 1) / TILE_SIZE - first_x;
+    tile_x = first_x + tile % region_tiles_x;
+    tile_y = first_y + tile / region_tiles_x;
+  }
+  int in_tile = i % (TILE_SIZE * TILE_SIZE);
+  *x = tile_x * TILE_SIZE + morton_coordinate(in_tile);
+  *y = tile_y * TILE_SIZE + morton_coordinate(in_tile >> 1);
+  return *x >= region.x && *x < region.z && *y >= region.y && *y < region.w;
+}
+
+// specialised builds have the launch parameters baked in as SPEC_* defines so
+// that the compiler can unroll the bounce and sample loops and fold the
+// camera maths, which goes by the size of the whole image `view` is part of.
+// the arguments are still passed, and ignored, except for the view's offset
+#ifdef SPEC_SAMPLES
+#define SAMPLES SPEC_SAMPLES
+#else
+#define SAMPLES samples
+#endif
+#ifdef SPEC_BOUNCES
+#define BOUNCES SPEC_BOUNCES
+#else
+#define BOUNCES bounces
+#endif
+#ifdef SPEC_WIDTH
+#define WIDTH SPEC_WIDTH
+#define HEIGHT SPEC_HEIGHT
+#else
+#define WIDTH width
+#define HEIGHT height
+#endif
+#ifdef SPEC_VIEW_WIDTH
+#define VIEW_WIDTH SPEC_VIEW_WIDTH
+#define VIEW_HEIGHT SPEC_VIEW_HEIGHT
+#else
+#define VIEW_WIDTH view.z
+#define VIEW_HEIGHT view.w
+#endif
+
+// progressive renderer: every launch traces `samples` new paths per pixel and
+// adds them to the persistent accumulation buffer, whose w component holds the
+// number of samples accumulated so far. the image shows the running average.
+// `frame` only decorrelates random sequences between launches, `sequence`
+// sobol ones from those of samples that were reprojected; `reset` makes the
+// launch discard whatever is in the buffer (scene or camera has changed).
+// the image is the part of a larger one given by `view`, the position of its
+// first pixel in xy and the larger one's size in zw, and cameras and random
+// sequences go by where pixels are in that one. only pixels inside `region`
+// (x0, y0, x1, y1) are rendered, one work item each, so that several devices
+// can share a frame. with adaptive sampling only those in `tiles` are
+__kernel void render_kernel(const int samples, const int bounces, SCENE_PARAMS
+    , OUTPUT_TYPE out, const int width, const int height
+    , __global float4 *accum, __global float *moments, const uint frame
+    , const uint sequence, const int reset, const float3 cam_pos
+    , const int4 view, const int4 region
+    , __global const int *tiles, const int num_tiles) {
+  Scene scene;
+  SCENE_INIT(scene);
+
+  // the pixel of this work item, along the Morton curve of its tile
+  int x_coord, y_coord;
+  if (!launch_pixel(get_global_id(0), region, tiles, num_tiles, WIDTH
+        , &x_coord, &y_coord))
+    return;
+
+  int pixel = y_coord * WIDTH + x_coord;
+  Sampler sampler = make_sampler(x_coord + view.x, y_coord + view.y
+      , VIEW_WIDTH, frame, sequence);
+  uint first_sample = reset ? 0 : (uint)accum[pixel].w;
+
+  // add the light contribution of each sample, through a random point of
+  // the pixel
+  float3 sum = (float3)(0.f, 0.f, 0.f);
+  float sum_l2 = 0.f;
+  for (int i = 0; i < SAMPLES; i++) {
+    start_sample(&sampler, first_sample + i);
+    Ray camray = create_cam_ray(x_coord + view.x, y_coord + view.y
+        , VIEW_WIDTH, VIEW_HEIGHT, cam_pos
+        , sample_2d(&sampler, scene.blue_noise));
+    float3 c = trace(BOUNCES, &scene, &camray, &sampler);
+    sum += c;
+    sum_l2 += luminance(c) * luminance(c);
+  }
+
+  float4 acc = accumulate(accum, moments, pixel, sum, sum_l2, SAMPLES, reset);
+  float3 finalcolor = acc.w > 0.f ? acc.xyz / acc.w : acc.xyz;
+  write_output(out, x_coord, y_coord, WIDTH, finalcolor);
+}
+#undef SAMPLES
+#undef BOUNCES
+#undef WIDTH
+#undef HEIGHT
+
+// wavefront mode: instead of one work item following a path through all its
+// bounces, each bounce of all paths is one launch of extend_kernel (find the
+// closest hits) followed by shade_kernel (bounce or finish the path). paths
+// that are still going are appended to a queue through an atomic counter, so
+// the next launch only has work items for live paths, packed together. the
+// host enqueues the kernels for every bounce and launches them over the whole
+// wave; work items past the queue length return right away. one path per
+// pixel is in flight at a time, path i belonging to the pixel of work item i
+// (see launch_pixel), and its samples follow each other like in render_kernel
 
-  uint rng_state = wang_hash(work_item_id);
+typedef struct {
+  float3 origin;
+  float3 dir;
+  float3 mask;
+  float3 radiance; // gathered along the path so far
+  float t; // inf when the ray missed everything
+  int hit_id;
+  float pdf; // of the direction the ray was sampled in
+  Sampler sampler;
+} Path;
 
-  unsigned int x_coord = work_item_id % width;
-  unsigned int y_coord = work_item_id / width;
+// starts sample `sample` of every pixel and queues the paths. the random
+// sequence of a pixel carries on from its previous sample. `sample_sum` gets
+// the radiance of finished samples in xyz and their squared luminance in w
+__kernel void generate_kernel(__global Path *paths, __global int *queue
+    , __global int *counters, __global float4 *sample_sum, const int width
+    , const int height, const float3 cam_pos, const int4 view
+    , const uint frame, const uint sequence, const int sample
+    , const int4 region
+    , __global const int *tiles, const int num_tiles
+    , __global const float4 *accum, const int reset
+    , __global const float *blue_noise) {
+  int i = get_global_id(0);
+  int x_coord, y_coord;
+  if (!launch_pixel(i, region, tiles, num_tiles, width, &x_coord, &y_coord))
+    return;
+
+  Path path;
+  path.sampler = sample == 0
+    ? make_sampler(x_coord + view.x, y_coord + view.y, view.z, frame
+        , sequence)
+    : paths[i].sampler;
+  start_sample(&path.sampler, (reset ? 0
+        : (uint)accum[y_coord * width + x_coord].w) + sample);
+  Ray ray = create_cam_ray(x_coord + view.x, y_coord + view.y, view.z
+      , view.w, cam_pos, sample_2d(&path.sampler, blue_noise));
+  path.origin = ray.origin;
+  path.dir = ray.dir;
+  path.mask = (float3)(1.f, 1.f, 1.f);
+  path.radiance = (float3)(0.f, 0.f, 0.f);
+  path.pdf = 0.f;
+  paths[i] = path;
+  queue[atomic_inc(&counters[0])] = i;
+  if (sample == 0)
+    sample_sum[i] = (float4)(0.f, 0.f, 0.f, 0.f);
+}
 
-  if (x_coord >= width || y_coord >= height)
+__kernel void extend_kernel(SCENE_PARAMS, __global Path *paths
+    , __global const int *queue, __global const int *counters
+    , const int in) {
+  Scene scene;
+  SCENE_INIT(scene);
+  int i = get_global_id(0);
+  if (i >= counters[in])
     return;
 
-  Ray camray = create_cam_ray(x_coord, y_coord, width, height);
+  __global Path *path = &paths[queue[i]];
+  Ray ray;
+  ray.origin = path->origin;
+  ray.dir = path->dir;
+  float t;
+  int hit_id = 0;
+  if (!intersect_scene(&scene, &ray, &t, &hit_id))
+    t = inf;
+  path->t = t;
+  path->hit_id = hit_id;
+}
 
-  // add the light contribution of each sample and average over all samples
-  float3 finalcolor = (float3)(0.f, 0.f, 0.f);
-  float inv_samples = 1.f / samples;
-  for (int i = 0; i < samples; i++)
-    finalcolor += trace(bounces, spheres, num_spheres, &camray, &rng_state) * inv_samples;
+// paths still going after this bounce go into `queue_out`, unless it is the
+// last one
+__kernel void shade_kernel(SCENE_PARAMS, __global Path *paths
+    , __global const int *queue_in, __global int *queue_out
+    , __global int *counters, const int in, const int last_bounce
+    , __global float4 *sample_sum) {
+  Scene scene;
+  SCENE_INIT(scene);
+  int i = get_global_id(0);
+  if (i >= counters[in])
+    return;
 
-  write_imagef(out, (int2)(x_coord, y_coord), linear_to_srgb_clamp4(finalcolor));
+  int p = queue_in[i];
+  Path path = paths[p];
+  bool alive = false;
+  if (path.t == inf)
+    path.radiance += path.mask * background();
+  else {
+    Ray ray;
+    ray.origin = path.origin;
+    ray.dir = path.dir;
+    alive = diffuse_bounce(&scene, path.hit_id, path.t, last_bounce, &ray
+        , &path.mask, &path.pdf, &path.radiance, &path.sampler);
+    path.origin = ray.origin;
+    path.dir = ray.dir;
+  }
+  paths[p] = path;
+  if (alive && !last_bounce)
+    queue_out[atomic_inc(&counters[in ^ 1])] = p;
+  else {
+    // only this path's pixel has a path in flight, no atomics needed
+    float l = luminance(path.radiance);
+    sample_sum[p] += (float4)(path.radiance, l * l);
+  }
 }
 
+__kernel void accumulate_kernel(__global const float4 *sample_sum
+    , OUTPUT_TYPE out, const int width, const int height
+    , __global float4 *accum, __global float *moments, const int samples
+    , const int reset, const int4 region, __global const int *tiles
+    , const int num_tiles) {
+  int i = get_global_id(0);
+  int x_coord, y_coord;
+  if (!launch_pixel(i, region, tiles, num_tiles, width, &x_coord, &y_coord))
+    return;
+  int pixel = y_coord * width + x_coord;
+
+  float4 sum = sample_sum[i];
+  float4 acc = accumulate(accum, moments, pixel, sum.xyz, sum.w, samples
+      , reset);
+  float3 finalcolor = acc.w > 0.f ? acc.xyz / acc.w : acc.xyz;
+  write_output(out, x_coord, y_coord, width, finalcolor);
+}
+
+// adaptive sampling: estimated relative error of each TILE_SIZE^2 tile, the
+// standard error of the mean luminance of its pixels in `region` relative to
+// that luminance, averaged over the tile. pixels with less than two samples
+// count as not converged at all, pixels that are white on screen however
+// noisy they are as converged
+__kernel void tile_error_kernel(__global const float4 *accum
+    , __global const float *moments, const int width, const int height
+    , const int4 region, __global float *tile_error) {
+  int tile = get_global_id(0);
+  int tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE
+    , tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+  if (tile >= tiles_x * tiles_y)
+    return;
+  int x0 = max(tile % tiles_x * TILE_SIZE, region.x)
+    , y0 = max(tile / tiles_x * TILE_SIZE, region.y)
+    , x1 = min(tile % tiles_x * TILE_SIZE + TILE_SIZE, region.z)
+    , y1 = min(tile / tiles_x * TILE_SIZE + TILE_SIZE, region.w);
+
+  float error = 0.f;
+  int pixels = 0;
+  for (int y = y0; y < y1; y++)
+    for (int x = x0; x < x1; x++) {
+      int pixel = y * width + x;
+      float4 acc = accum[pixel];
+      float n = acc.w;
+      if (n < 2.f) {
+        error = inf;
+        continue;
+      }
+      float mean = luminance(acc.xyz) / n;
+      float variance = max(moments[pixel] / n - mean * mean, 0.f)
+        * n / (n - 1.f);
+      float std_error = sqrt(variance / n);
+      // the offset keeps near black pixels from needing endless samples
+      error += mean - 2.f * std_error > 1.f ? 0.f
+        : std_error / (mean + 0.05f);
+      ++pixels;
+    }
+  tile_error[tile] = pixels > 0 && error < inf ? error / pixels : error;
+}
+
+// denoising: the edge-avoiding a-trous wavelet filter of SVGF (Schied et
+// al. 2017), run over the average radiance after every launch. radiance is
+// divided by the albedo of the first hit so that only the lighting is
+// blurred, and weights fall off across edges of the first hits' normals
+// and depths and where luminances differ more than their noise explains
+
+// first hit through the centre of every pixel of `region`: `albedo` gets
+// its colour and `normal_depth` its normal, facing the camera, and distance.
+// pixels whose ray misses everything get zeros
+__kernel void aov_kernel(SCENE_PARAMS, const int width, const int height
+    , const float3 cam_pos, const int4 view, const int4 region
+    , __global float4 *albedo
+    , __global float4 *normal_depth) {
+  Scene scene;
+  SCENE_INIT(scene);
+  int i = get_global_id(0);
+  int x_coord = i % width, y_coord = region.y + i / width;
+  if (y_coord >= region.w)
+    return;
+
+  Ray ray = create_cam_ray(x_coord + view.x, y_coord + view.y, view.z
+      , view.w, cam_pos, (float2)(0.5f, 0.5f));
+  float t;
+  int hit_id = 0;
+  float4 a = (float4)(0.f, 0.f, 0.f, 0.f), nd = a;
+  if (intersect_scene(&scene, &ray, &t, &hit_id)) {
+    float3 normal, color, emission;
+    surface_at(&scene, hit_id, ray.origin + ray.dir * t, &normal, &color
+        , &emission);
+    a = (float4)(color, 0.f);
+    nd = (float4)(dot(normal, ray.dir) < 0.f ? normal : -normal, t);
+  }
+  int pixel = y_coord * width + x_coord;
+  albedo[pixel] = a;
+  normal_depth[pixel] = nd;
+}
+
+// what radiance is divided by, the albedo except where it is black
+float3 demodulation(const float4 albedo) {
+  return (float3)(albedo.x > 0.f ? albedo.x : 1.f
+      , albedo.y > 0.f ? albedo.y : 1.f, albedo.z > 0.f ? albedo.z : 1.f);
+}
+
+// how much depths may differ per pixel of distance on the surface pixel
+// (x, y) sees, the steeper of its horizontal and vertical slopes. a slope is
+// the smaller change of depth to the neighbours on either side, so that it
+// is not taken across the edge of the surface
+float depth_slope(__global const float4 *normal_depth, const int x
+    , const int y, const int width, const int4 region) {
+  float depth = normal_depth[y * width + x].w;
+  float left = normal_depth[y * width + max(x - 1, region.x)].w
+    , right = normal_depth[y * width + min(x + 1, region.z - 1)].w
+    , down = normal_depth[max(y - 1, region.y) * width + x].w
+    , up = normal_depth[min(y + 1, region.w - 1) * width + x].w;
+  return max(min(fabs(left - depth), fabs(right - depth))
+      , min(fabs(down - depth), fabs(up - depth)));
+}
+
+// how alike the first hits of two pixels `distance` pixels apart are, 0
+// across edges. missed rays have no normal and are like nothing
+float geometry_weight(const float4 normal_depth_p, const float4 normal_depth_q
+    , const float slope, const float distance) {
+  // the cosine between the normals to the 128th
+  float w_normal = max(dot(normal_depth_p.xyz, normal_depth_q.xyz), 0.f);
+  for (int i = 0; i < 7; i++)
+    w_normal *= w_normal;
+  float w_depth = exp(-fabs(normal_depth_p.w - normal_depth_q.w)
+      / (slope * distance + 1e-3f));
+  return w_normal * w_depth;
+}
+
+// the image the filter starts from, demodulated radiance in xyz and the
+// variance of its luminance in w. with fewer than 4 samples a pixel cannot
+// tell its variance, it takes that of the 7x7 pixels around it on the same
+// surface instead
+__kernel void denoise_input_kernel(__global const float4 *accum
+    , __global const float *moments, __global const float4 *albedo
+    , __global const float4 *normal_depth, const int width, const int height
+    , const int4 region, __global float4 *color) {
+  int i = get_global_id(0);
+  int x_coord = i % width, y_coord = region.y + i / width;
+  if (y_coord >= region.w)
+    return;
+  int pixel = y_coord * width + x_coord;
+
+  float4 acc = accum[pixel];
+  float n = acc.w;
+  if (n <= 0.f) {
+    color[pixel] = (float4)(0.f, 0.f, 0.f, 0.f);
+    return;
+  }
+  // mean luminance and mean squared luminance of the samples
+  float l = luminance(acc.xyz) / n, l2 = moments[pixel] / n;
+  if (n < 4.f) {
+    float4 nd = normal_depth[pixel];
+    float slope = depth_slope(normal_depth, x_coord, y_coord, width, region);
+    float weight_sum = 1.f;
+    for (int dy = -3; dy <= 3; dy++)
+      for (int dx = -3; dx <= 3; dx++) {
+        int x = x_coord + dx, y = y_coord + dy;
+        if ((dx == 0 && dy == 0) || x < region.x || x >= region.z
+            || y < region.y || y >= region.w)
+          continue;
+        int q = y * width + x;
+        float4 acc_q = accum[q];
+        if (acc_q.w <= 0.f)
+          continue;
+        float w = geometry_weight(nd, normal_depth[q], slope
+            , sqrt((float)(dx * dx + dy * dy)));
+        l += w * luminance(acc_q.xyz) / acc_q.w;
+        l2 += w * moments[q] / acc_q.w;
+        weight_sum += w;
+      }
+    l /= weight_sum;
+    l2 /= weight_sum;
+  }
+  float3 demodulate = demodulation(albedo[pixel]);
+  float l_demodulate = luminance(demodulate);
+  // of the mean of the samples
+  float variance = max(l2 - l * l, 0.f) / n
+    / (l_demodulate * l_demodulate);
+  color[pixel] = (float4)(acc.xyz / n / demodulate, variance);
+}
+
+// one pass of the filter, 5x5 taps `step` pixels apart, over `in` into
+// `filtered`. variances are filtered along with the colours, with the
+// squared weights. the last pass puts the albedo back, leaving radiance in
+// `filtered` and the image in `out`
+__kernel void atrous_kernel(__global const float4 *in
+    , __global float4 *filtered, __global const float4 *albedo
+    , __global const float4 *normal_depth, const int width, const int height
+    , const int4 region, const int step, const int last, OUTPUT_TYPE out) {
+  // of the B3 spline
+  const float kernel_weights[3] = { 3.f / 8.f, 1.f / 4.f, 1.f / 16.f };
+  int i = get_global_id(0);
+  int x_coord = i % width, y_coord = region.y + i / width;
+  if (y_coord >= region.w)
+    return;
+  int pixel = y_coord * width + x_coord;
+
+  // the variance of the luminance weight is blurred 3x3 to steady it
+  float variance = 0.f, variance_weights = 0.f;
+  for (int dy = -1; dy <= 1; dy++)
+    for (int dx = -1; dx <= 1; dx++) {
+      int x = x_coord + dx, y = y_coord + dy;
+      if (x < region.x || x >= region.z || y < region.y || y >= region.w)
+        continue;
+      float w = (dx == 0 ? 2.f : 1.f) * (dy == 0 ? 2.f : 1.f);
+      variance += w * in[y * width + x].w;
+      variance_weights += w;
+    }
+  float sigma_l = 4.f * sqrt(variance / variance_weights) + 1e-6f;
+
+  float4 c = in[pixel];
+  float4 nd = normal_depth[pixel];
+  float l = luminance(c.xyz);
+  float slope = depth_slope(normal_depth, x_coord, y_coord, width, region);
+  float w_centre = kernel_weights[0] * kernel_weights[0];
+  float3 sum = w_centre * c.xyz;
+  float variance_sum = w_centre * w_centre * c.w, weight_sum = w_centre;
+  for (int dy = -2; dy <= 2; dy++)
+    for (int dx = -2; dx <= 2; dx++) {
+      int x = x_coord + dx * step, y = y_coord + dy * step;
+      if ((dx == 0 && dy == 0) || x < region.x || x >= region.z
+          || y < region.y || y >= region.w)
+        continue;
+      int q = y * width + x;
+      float4 c_q = in[q];
+      float w = kernel_weights[abs(dx)] * kernel_weights[abs(dy)]
+        * geometry_weight(nd, normal_depth[q], slope
+            , step * sqrt((float)(dx * dx + dy * dy)))
+        * exp(-fabs(l - luminance(c_q.xyz)) / sigma_l);
+      sum += w * c_q.xyz;
+      variance_sum += w * w * c_q.w;
+      weight_sum += w;
+    }
+
+  if (!last) {
+    filtered[pixel] = (float4)(sum / weight_sum
+        , variance_sum / (weight_sum * weight_sum));
+    return;
+  }
+  float3 radiance = sum / weight_sum * demodulation(albedo[pixel]);
+  filtered[pixel] = (float4)(radiance, 1.f);
+  write_output(out, x_coord, y_coord, width, radiance);
+}
+
+// temporal reuse: when only spheres or the camera have moved, pixels carry on
+// from the samples of the pixel that saw the same point before instead of
+// starting over. the point a pixel sees is followed back by the motion of
+// its sphere (triangles never move) and projected into the camera as it
+// was. that pixel's samples are taken if it saw the same sphere or triangle
+// at the depth the point had, anything else is disoccluded. they count as
+// at most `max_history` samples, so that those of earlier frames fade out
+// like an exponential moving average as new ones come in and lighting that
+// changed with the motion catches up
+
+// the id of what pixels whose centre ray misses everything see
+#define NO_HIT 0x7fffffff
+
+// where the ray from `cam_pos` through `p` crosses the screen, in pixels of
+// the part `view` of it. the inverse of create_cam_ray, for points in front
+// of the camera
+float2 project_to_screen(const float3 p, const float3 cam_pos
+    , const int4 view) {
+  float3 on_screen = cam_pos + (p - cam_pos) * (cam_pos.z / (cam_pos.z - p.z));
+  float aspect_ratio = (float)view.z / (float)view.w;
+  return (float2)((on_screen.x / aspect_ratio + 0.5f) * (float)view.z
+      - (float)view.x, (on_screen.y + 0.5f) * (float)view.w - (float)view.y);
+}
+
+// fills `accum` and `moments` in the rows of `region` with what reprojects
+// from `history_accum` and `history_moments`, those of the launch before,
+// for the launch to add to. `history_ids` and `history_depths` are what the
+// centres of the pixels saw then, in rows [history_begin, history_end), and
+// `hit_ids` and `hit_depths` get the same for this launch.
+// `previous_spheres` and `previous_cam_pos` are where the spheres and the
+// camera were
+__kernel void reproject_kernel(SCENE_PARAMS, const int width, const int height
+    , const float3 cam_pos, const int4 view, const int4 region
+    , __global const float4 *previous_spheres, const float3 previous_cam_pos
+    , const int history_begin, const int history_end
+    , __global const float4 *history_accum
+    , __global const float *history_moments
+    , __global const int *history_ids, __global const float *history_depths
+    , const float max_history, __global float4 *accum
+    , __global float *moments, __global int *hit_ids
+    , __global float *hit_depths) {
+  Scene scene;
+  SCENE_INIT(scene);
+  int i = get_global_id(0);
+  int x_coord = i % width, y_coord = region.y + i / width;
+  if (y_coord >= region.w)
+    return;
+
+  Ray ray = create_cam_ray(x_coord + view.x, y_coord + view.y, view.z
+      , view.w, cam_pos, (float2)(0.5f, 0.5f));
+  float t;
+  int hit_id = 0;
+  // the background is the same in every direction, misses stay where they are
+  float2 previous = (float2)((float)x_coord + 0.5f, (float)y_coord + 0.5f);
+  float depth = 0.f, previous_depth = 0.f;
+  if (intersect_scene(&scene, &ray, &t, &hit_id)) {
+    float3 p = ray.origin + ray.dir * t;
+    if (hit_id >= 0)
+      p += previous_spheres[hit_id].xyz - sphere_at(&scene, hit_id).xyz;
+    depth = t;
+    previous_depth = distance(p, previous_cam_pos);
+    previous = p.z < previous_cam_pos.z
+      ? project_to_screen(p, previous_cam_pos, view)
+      : (float2)(-1.f, -1.f);
+  } else
+    hit_id = NO_HIT;
+  int pixel = y_coord * width + x_coord;
+  hit_ids[pixel] = hit_id;
+  hit_depths[pixel] = depth;
+
+  float4 acc = (float4)(0.f, 0.f, 0.f, 0.f);
+  float moment = 0.f;
+  if (previous.x >= 0.f && previous.x < (float)width
+      && previous.y >= (float)history_begin
+      && previous.y < (float)history_end) {
+    int q = (int)previous.y * width + (int)previous.x;
+    // depths of neighbouring pixels differ by less than this unless they see
+    // different surfaces
+    if (history_ids[q] == hit_id
+        && fabs(history_depths[q] - previous_depth) <= 0.05f * previous_depth) {
+      acc = history_accum[q];
+      moment = history_moments[q];
+      if (acc.w > max_history) {
+        float scale = max_history / acc.w;
+        acc *= scale;
+        moment *= scale;
+      }
+    }
+  }
+  accum[pixel] = acc;
+  moments[pixel] = moment;
+}
@@ -0,0 +1,291 @@
+#include "options.hh"
+#include "utils.hh"
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+static void usage(const char *argv0) {
+  printf("usage: %s [options]\n"
+      "  -h, --help               show this message\n"
+      "  -l, --list-devices       list OpenCL platforms and devices and exit\n"
+      "  -p, --platform <P>       OpenCL platform by index or name\n"
+      "  -d, --device <D>         OpenCL device by index or name, a comma "
+      "separated\n"
+      "                           list of them or \"all\" to split frames "
+      "between\n"
+      "                           several devices\n"
+      "  -t, --device-type <T>    gpu, cpu or any (default: gpu, headless: any)\n"
+      "      --backend <B>        cl, cpu for the native multithreaded "
+      "renderer, or auto\n"
+      "                           for cl if it has a device of the type "
+      "above (default)\n"
+      "      --threads <N>        threads of the native renderer (default: "
+      "0, all)\n"
+      "  -W, --width <N>          image width (default: 800)\n"
+      "  -H, --height <N>         image height (default: 600)\n"
+      "  -s, --samples <N>        samples per pixel per launch (default: 10)\n"
+      "  -b, --bounces <N>        maximum path length (default: 8)\n"
+      "      --scene <S>          cornell, spheres:N for the box filled "
+      "with N\n"
+      "                           random spheres or obj:FILE for the box "
+      "with a\n"
+      "                           mesh in it (default: cornell)\n"
+      "      --adaptive <E>       after 16 spp only sample tiles whose "
+      "relative error\n"
+      "                           is above E, e.g. 0.15 (default: 0, off)\n"
+      "      --no-nee             only find light by bouncing into it "
+      "(toggle with 'n')\n"
+      "      --sampler <S>        random, sobol (Owen scrambled) or blue "
+      "for sobol with\n"
+      "                           blue noise error across the screen "
+      "(default: blue)\n"
+      "      --denoise            smooth the noise out of frames with an "
+      "edge-avoiding\n"
+      "                           a-trous wavelet filter (toggle with "
+      "'d')\n"
+      "      --temporal           keep samples through animation where "
+      "what pixels see\n"
+      "                           only moved (toggle with 't')\n"
+      "      --wavefront          trace paths a bounce at a time with "
+      "separate kernels\n"
+      "                           (toggle with 'm')\n"
+      "      --exposure <EV>      brighten the window's image by EV stops, "
+      "negative to\n"
+      "                           darken (default: 0, change with 'x' and "
+      "'z')\n"
+      "      --tone-map <T>       clip, reinhard or aces: how the window "
+      "brings radiance\n"
+      "                           above 1 into range (default: clip, "
+      "cycle with 'c')\n"
+      "      --frame-budget <MS>  keep frames at MS milliseconds by lowering "
+      "samples and\n"
+      "                           then bounces below what is set (toggle "
+      "with 'b')\n"
+      "      --budget-resolution  and then the resolution, down to a "
+      "quarter\n"
+      "      --pipeline <N>       render into a ring of N textures, 2 or 3, "
+      "without\n"
+      "                           waiting for a frame before presenting "
+      "the one before\n"
+      "      --specialise         compile kernels for the samples, bounces "
+      "and image\n"
+      "                           size in use, in the background\n"
+      "      --cl-math <M>        precise, mad (-cl-mad-enable) or fast\n"
+      "                           (-cl-fast-relaxed-math) (default: "
+      "precise)\n"
+      "      --headless           render without a window and write a file\n"
+      "      --spp <N>            samples per pixel of a headless render "
+      "(default: 1024)\n"
+      "      --tile <N>           render headless images larger than NxN "
+      "in tiles of NxN\n"
+      "                           pixels, 0 for in one go (default: 2048)\n"
+      "      --bench              time fixed scenes and settings and write "
+      "the results\n"
+      "                           as JSON\n"
+      "      --bench-denoise      time frames of a few samples with and "
+      "without\n"
+      "                           denoising and write their errors "
+      "against a reference\n"
+      "                           as JSON\n"
+      "      --bench-runs <N>     timed frames per benchmark case (default: "
+      "20)\n"
+      "  -o, --output <FILE>      .ppm (sRGB) or .pfm (linear) output of a "
+      "headless render\n"
+      "                           or the benchmark's JSON (default: "
+      "image.ppm, bench.json)\n"
+      "      --reference <FILE>   .pfm a headless render prints its RMSE "
+      "against\n"
+      "                           whenever it passes a power of two spp\n"
+      "      --kernel-cache <DIR> where compiled OpenCL programs are kept, "
+      "\"none\" to\n"
+      "                           always compile (default: "
+      "$XDG_CACHE_HOME/bblik or\n"
+      "                           ~/.cache/bblik)\n"
+      "      --profile <FILE>     time every stage of the frames, print "
+      "per-stage\n"
+      "                           statistics and write a Chrome trace of "
+      "the last\n"
+      "                           frames to FILE on 'p' and at exit\n"
+      "      --record <FILE>      record the window's frames as files "
+      "numbered by a\n"
+      "                           pattern like frame%%05d.ppm (.pfm for "
+      "linear radiance)\n"
+      "                           or as a .y4m video, \"-\" streaming it "
+      "to standard\n"
+      "                           output. frames are dropped rather than "
+      "holding up\n"
+      "                           rendering. %%%% in a pattern is a "
+      "literal %%\n"
+      , argv0);
+}
+
+static float parse_float(const char *opt, const char *value, float min) {
+  char *end;
+  float result = strtof(value, &end);
+  if (*value == 0 || *end != 0 || !(result >= min))
+    die("invalid value \"%s\" for %s", value, opt);
+  return result;
+}
+
+static int parse_int(const char *opt, const char *value, int min
+    , int max = INT_MAX) {
+  char *end;
+  long result = strtol(value, &end, 10);
+  // strtol saturates on overflow, which is out of range either way
+  if (*value == 0 || *end != 0 || result < min || result > max)
+    die("invalid value \"%s\" for %s", value, opt);
+  return (int)result;
+}
+
+void parse_options(int argc, char **argv, options *opts) {
+  opts->headless = false;
+  opts->bench = false;
+  opts->bench_denoise = false;
+  opts->list_devices = false;
+  opts->wavefront = false;
+  opts->backend = "auto";
+  opts->threads = 0;
+  opts->nee = true;
+  opts->sampler = "blue";
+  opts->denoise = false;
+  opts->temporal = false;
+  opts->exposure = 0.f;
+  opts->tone_map = "clip";
+  opts->width = 800;
+  opts->height = 600;
+  opts->samples = 10;
+  opts->bounces = 8;
+  opts->adaptive = 0.f;
+  opts->frame_budget = 0.f;
+  opts->budget_resolution = false;
+  opts->spp = 1024;
+  opts->tile = 2048;
+  opts->bench_runs = 20;
+  opts->pipeline = 0;
+  opts->specialise = false;
+  opts->cl_math = "precise";
+  opts->scene = "cornell";
+
+  for (int i = 1; i < argc; i++) {
+    const char *opt = argv[i];
+    auto is = [opt](const char *short_name, const char *long_name) {
+      return (short_name && strcmp(opt, short_name) == 0)
+        || strcmp(opt, long_name) == 0;
+    };
+    auto value = [&]() {
+      if (i + 1 >= argc)
+        die("option %s requires an argument", opt);
+      return argv[++i];
+    };
+    if (is("-h", "--help")) {
+      usage(argv[0]);
+      exit(0);
+    } else if (is("-l", "--list-devices"))
+      opts->list_devices = true;
+    else if (is("-p", "--platform"))
+      opts->platform = value();
+    else if (is("-d", "--device"))
+      opts->device = value();
+    else if (is("-t", "--device-type")) {
+      opts->device_type = value();
+      if (opts->device_type != "gpu" && opts->device_type != "cpu"
+          && opts->device_type != "any")
+        die("unknown device type \"%s\"", opts->device_type.c_str());
+    } else if (is(nullptr, "--backend")) {
+      opts->backend = value();
+      if (opts->backend != "auto" && opts->backend != "cl"
+          && opts->backend != "cpu")
+        die("unknown backend \"%s\"", opts->backend.c_str());
+    } else if (is(nullptr, "--threads"))
+      opts->threads = parse_int(opt, value(), 0);
+    else if (is("-W", "--width"))
+      opts->width = parse_int(opt, value(), 1);
+    else if (is("-H", "--height"))
+      opts->height = parse_int(opt, value(), 1);
+    else if (is("-s", "--samples"))
+      opts->samples = parse_int(opt, value(), 0);
+    else if (is("-b", "--bounces"))
+      opts->bounces = parse_int(opt, value(), 0);
+    else if (is(nullptr, "--scene"))
+      opts->scene = value();
+    else if (is(nullptr, "--adaptive"))
+      opts->adaptive = parse_float(opt, value(), 0.f);
+    else if (is(nullptr, "--no-nee"))
+      opts->nee = false;
+    else if (is(nullptr, "--sampler")) {
+      opts->sampler = value();
+      if (opts->sampler != "random" && opts->sampler != "sobol"
+          && opts->sampler != "blue")
+        die("unknown sampler \"%s\"", opts->sampler.c_str());
+    } else if (is(nullptr, "--denoise"))
+      opts->denoise = true;
+    else if (is(nullptr, "--temporal"))
+      opts->temporal = true;
+    else if (is(nullptr, "--exposure"))
+      opts->exposure = parse_float(opt, value(), -HUGE_VALF);
+    else if (is(nullptr, "--tone-map")) {
+      opts->tone_map = value();
+      if (opts->tone_map != "clip" && opts->tone_map != "reinhard"
+          && opts->tone_map != "aces")
+        die("unknown tone mapping \"%s\"", opts->tone_map.c_str());
+    } else if (is(nullptr, "--wavefront"))
+      opts->wavefront = true;
+    else if (is(nullptr, "--specialise"))
+      opts->specialise = true;
+    else if (is(nullptr, "--cl-math")) {
+      opts->cl_math = value();
+      if (opts->cl_math != "precise" && opts->cl_math != "mad"
+          && opts->cl_math != "fast")
+        die("unknown math mode \"%s\"", opts->cl_math.c_str());
+    } else if (is(nullptr, "--headless"))
+      opts->headless = true;
+    else if (is(nullptr, "--spp"))
+      opts->spp = parse_int(opt, value(), 1);
+    else if (is(nullptr, "--tile"))
+      opts->tile = parse_int(opt, value(), 0);
+    else if (is(nullptr, "--bench"))
+      opts->bench = true;
+    else if (is(nullptr, "--bench-denoise"))
+      opts->bench_denoise = true;
+    else if (is(nullptr, "--bench-runs"))
+      opts->bench_runs = parse_int(opt, value(), 1);
+    else if (is(nullptr, "--frame-budget"))
+      opts->frame_budget = parse_float(opt, value(), 0.f);
+    else if (is(nullptr, "--budget-resolution"))
+      opts->budget_resolution = true;
+    else if (is(nullptr, "--pipeline"))
+      opts->pipeline = parse_int(opt, value(), 2, 3);
+    else if (is("-o", "--output"))
+      opts->output = value();
+    else if (is(nullptr, "--reference"))
+      opts->reference = value();
+    else if (is(nullptr, "--profile"))
+      opts->profile = value();
+    else if (is(nullptr, "--record"))
+      opts->record = value();
+    else if (is(nullptr, "--kernel-cache"))
+      opts->kernel_cache = value();
+    else {
+      usage(argv[0]);
+      die("unknown option \"%s\"", opt);
+    }
+  }
+
+  if (opts->device_type.empty())
+    opts->device_type = opts->headless || opts->bench || opts->bench_denoise
+      ? "any" : "gpu";
+  if (opts->output.empty())
+    opts->output = opts->bench || opts->bench_denoise ? "bench.json"
+      : "image.ppm";
+  if (opts->kernel_cache == "none")
+    opts->kernel_cache.clear();
+  else if (opts->kernel_cache.empty()) {
+    const char *xdg = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+    if (xdg && *xdg)
+      opts->kernel_cache = std::string(xdg) + "/bblik";
+    else if (home && *home)
+      opts->kernel_cache = std::string(home) + "/.cache/bblik";
+  }
+}
+
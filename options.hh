@@ -0,0 +1,57 @@
+#pragma once
+
+#include <string>
+
+struct options {
+  bool headless;
+  bool bench;
+  // times and compares frames with and without denoising
+  bool bench_denoise;
+  bool list_devices;
+  bool wavefront; // trace a bounce of all paths at a time
+  bool nee; // sample emissive spheres directly
+  std::string sampler; // "random", "sobol" or "blue"
+  bool denoise; // filter frames guided by what pixels see first
+  bool temporal; // reproject samples into frames after motion
+  float exposure; // of the window, in stops
+  std::string tone_map; // "clip", "reinhard" or "aces"
+  // platform and device are given either by index or by (part of) their name
+  std::string platform;
+  std::string device;
+  std::string device_type; // "gpu", "cpu" or "any"
+  // "cl", "cpu" for the native renderer or "auto" for OpenCL when it has a
+  // device of device_type
+  std::string backend;
+  int threads; // of the native renderer, 0 for all hardware threads
+  int width, height;
+  int samples, bounces;
+  float adaptive; // error threshold of adaptive sampling, 0 for off
+  // frame time in ms interactive sessions hold by lowering samples and
+  // bounces, 0 for off
+  float frame_budget;
+  bool budget_resolution; // and also the render resolution
+  int spp; // total samples per pixel of a headless render
+  // headless renders larger than this in either direction go a tile of
+  // this many pixels square at a time, 0 for always in one go
+  int tile;
+  int bench_runs; // timed frames per benchmark case
+  // textures frames go round while the next ones render, 0 for none
+  int pipeline;
+  std::string output;
+  // .pfm image a headless render is compared against, empty for none
+  std::string reference;
+  std::string profile; // Chrome trace of the last frames, empty for none
+  // numbered .ppm or .pfm files or a .y4m stream ("-" for standard output)
+  // the window's frames are recorded into, empty for none
+  std::string record;
+  bool specialise; // kernels compiled for the launch parameters
+  // "precise", "mad" or "fast": how freely OpenCL compilers may rearrange
+  // floating point maths
+  std::string cl_math;
+  // compiled OpenCL programs, empty for always compiling from source
+  std::string kernel_cache;
+  std::string scene;
+};
+
+void parse_options(int argc, char **argv, options *opts);
+
@@ -0,0 +1,187 @@
+#include "profiler.hh"
+#include "utils.hh"
+#include <algorithm>
+#include <cstdio>
+
+frame_profiler::frame_profiler(size_t window)
+  : _epoch(std::chrono::steady_clock::now())
+  , _window(std::max<size_t>(window, 1))
+  , _frame_begin(0.)
+  , _frame_count(0) {
+  _frame_begin = now();
+}
+
+double frame_profiler::now() {
+  return std::chrono::duration<double, std::micro>(
+      std::chrono::steady_clock::now() - _epoch).count();
+}
+
+cl::Event* frame_profiler::command(const std::string &track
+    , const char *stage) {
+  _commands.push_back({ track, stage, cl::Event(), now() });
+  return &_commands.back().event;
+}
+
+void frame_profiler::command(const std::string &track, const char *stage
+    , const cl::Event &event) {
+  // the command was queued a moment ago, close enough for the timeline
+  _commands.push_back({ track, stage, event, now() });
+}
+
+void frame_profiler::host(const char *stage, double begin) {
+  double end = now();
+  _host_spans.push_back({ "host", stage, begin, begin, begin, end, false });
+}
+
+void frame_profiler::end_frame() {
+  frame f;
+  f.begin = _frame_begin;
+  f.end = now();
+  f.spans = std::move(_host_spans);
+  _host_spans.clear();
+  // commands of pipelined frames may still be running, they go into the
+  // frame in which they complete
+  std::deque<pending_command> running;
+  for (const pending_command &c : _commands) {
+    cl_int status_err;
+    cl_int status = c.event.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>(
+        &status_err);
+    if (status_err == CL_SUCCESS && status > CL_COMPLETE) {
+      running.push_back(c);
+      continue;
+    }
+    cl_int err[4];
+    cl_ulong queued = c.event.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>(
+        &err[0])
+      , submit = c.event.getProfilingInfo<CL_PROFILING_COMMAND_SUBMIT>(
+          &err[1])
+      , start = c.event.getProfilingInfo<CL_PROFILING_COMMAND_START>(&err[2])
+      , end = c.event.getProfilingInfo<CL_PROFILING_COMMAND_END>(&err[3]);
+    // some implementations do not time every kind of command, e.g. the
+    // acquiring of GL objects
+    if (err[0] != CL_SUCCESS || err[1] != CL_SUCCESS || err[2] != CL_SUCCESS
+        || err[3] != CL_SUCCESS)
+      continue;
+    auto to_host = [&](cl_ulong t) {
+      return c.enqueued + ((double)t - (double)queued) / 1e3;
+    };
+    f.spans.push_back({ c.track, c.stage, c.enqueued, to_host(submit)
+        , to_host(start), to_host(end), true });
+  }
+  _commands.swap(running);
+  _frames.push_back(std::move(f));
+  if (_frames.size() > _window)
+    _frames.pop_front();
+  ++_frame_count;
+  _frame_begin = now();
+}
+
+void frame_profiler::print_stats() {
+  if (_frames.empty())
+    return;
+  struct stage_stats {
+    std::string name;
+    double run, max_run, wait;
+    unsigned long long int commands;
+  };
+  // stages in the order they first show up
+  std::vector<stage_stats> stages;
+  std::map<std::string, size_t> index;
+  double frame_ms = 0.;
+  for (const frame &f : _frames) {
+    frame_ms += (f.end - f.begin) / 1e3;
+    std::map<size_t, double> frame_run;
+    for (const span &s : f.spans) {
+      std::string name = s.track + ": " + s.stage;
+      auto it = index.find(name);
+      if (it == index.end()) {
+        it = index.emplace(name, stages.size()).first;
+        stages.push_back({ name, 0., 0., 0., 0 });
+      }
+      stage_stats &st = stages[it->second];
+      double run = (s.end - s.start) / 1e3;
+      st.run += run;
+      st.wait += (s.start - s.queued) / 1e3;
+      ++st.commands;
+      frame_run[it->second] += run;
+    }
+    for (const auto &run : frame_run)
+      stages[run.first].max_run = std::max(stages[run.first].max_run
+          , run.second);
+  }
+  double frames = (double)_frames.size();
+  printf("\nlast %zu frames, %.3f ms per frame\n", _frames.size()
+      , frame_ms / frames);
+  printf("%-40s %10s %10s %10s %8s\n", "stage", "run ms", "max ms"
+      , "wait ms", "calls");
+  // run times are per frame, wait times (from queued to started) per call
+  for (const stage_stats &st : stages)
+    printf("%-40s %10.3f %10.3f %10.3f %8.1f\n", st.name.c_str()
+        , st.run / frames, st.max_run, st.wait / st.commands
+        , st.commands / frames);
+}
+
+static std::string json_string(const std::string &s) {
+  std::string quoted = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\')
+      quoted += '\\';
+    quoted += c;
+  }
+  return quoted + "\"";
+}
+
+void frame_profiler::write_trace(const std::string &filename) {
+  FILE *f = fopen(filename.c_str(), "w");
+  if (!f)
+    die("cannot write %s", filename.c_str());
+  // a thread of the trace per track, named by metadata events
+  std::map<std::string, int> tids;
+  auto tid = [&](const std::string &track) {
+    auto it = tids.find(track);
+    if (it == tids.end()) {
+      it = tids.emplace(track, (int)tids.size()).first;
+      fprintf(f, "  { \"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+          "\"tid\": %d, \"args\": { \"name\": %s } },\n", it->second
+          , json_string(track).c_str());
+      fprintf(f, "  { \"name\": \"thread_sort_index\", \"ph\": \"M\", "
+          "\"pid\": 1, \"tid\": %d, \"args\": { \"sort_index\": %d } },\n"
+          , it->second, it->second);
+    }
+    return it->second;
+  };
+  auto event = [&](const std::string &track, const std::string &name
+      , double begin, double end, const std::string &args) {
+    int t = tid(track);
+    fprintf(f, "  { \"name\": %s, \"ph\": \"X\", \"pid\": 1, \"tid\": %d, "
+        "\"ts\": %.3f, \"dur\": %.3f%s },\n", json_string(name).c_str(), t
+        , begin, std::max(end - begin, 0.), args.c_str());
+  };
+
+  fprintf(f, "{\n\"displayTimeUnit\": \"ms\",\n\"traceEvents\": [\n");
+  unsigned long long int number = _frame_count - _frames.size();
+  tid("frames");
+  tid("host");
+  for (const frame &fr : _frames) {
+    event("frames", "frame " + std::to_string(number++), fr.begin, fr.end
+        , "");
+    for (const span &s : fr.spans) {
+      if (!s.device) {
+        event(s.track, s.stage, s.start, s.end, "");
+        continue;
+      }
+      // the time a command spent waiting goes on a track of its own so that
+      // it can overlap the previous command's run
+      char args[128];
+      snprintf(args, sizeof(args), ", \"args\": { \"queued_us\": %.3f, "
+          "\"submit_us\": %.3f }", s.queued, s.submit);
+      event(s.track + " queue", s.stage, s.queued, s.start, args);
+      event(s.track, s.stage, s.start, s.end, args);
+    }
+  }
+  // the process name closes the list, which cannot end in a comma
+  fprintf(f, "  { \"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, "
+      "\"args\": { \"name\": \"bblik\" } }\n]\n}\n");
+  fclose(f);
+  printf("wrote %s\n", filename.c_str());
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <CL/cl.hpp>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+// times the stages of frames: OpenCL commands through their profiling events
+// and host code through the clock. the times of the last frames are kept for
+// rolling per-stage statistics and can be written out as a Chrome trace
+// (chrome://tracing, ui.perfetto.dev) that puts the host's and every device's
+// work on one timeline. queues have to be created with
+// CL_QUEUE_PROFILING_ENABLE
+class frame_profiler {
+  struct pending_command {
+    std::string track;
+    const char *stage;
+    cl::Event event;
+    // host time when it was enqueued, device times are mapped to the host
+    // clock by taking CL_PROFILING_COMMAND_QUEUED as this moment
+    double enqueued;
+  };
+  // a finished command or host span, times in microseconds since the
+  // profiler was made
+  struct span {
+    std::string track;
+    const char *stage;
+    double queued, submit, start, end;
+    bool device;
+  };
+  struct frame {
+    double begin, end;
+    std::vector<span> spans;
+  };
+  std::chrono::steady_clock::time_point _epoch;
+  size_t _window;
+  // events of the frame in progress, a deque so that pointers handed out
+  // stay valid
+  std::deque<pending_command> _commands;
+  std::vector<span> _host_spans;
+  double _frame_begin;
+  std::deque<frame> _frames;
+  unsigned long long int _frame_count;
+public:
+  // statistics and the trace cover the last `window` frames
+  frame_profiler(size_t window = 120);
+  // microseconds since the profiler was made
+  double now();
+  // an event to pass to the enqueue call of a command of `stage`, run in the
+  // queue of `track`. call it right before enqueueing
+  cl::Event* command(const std::string &track, const char *stage);
+  // adds a command whose event is kept elsewhere, right after enqueueing it
+  void command(const std::string &track, const char *stage
+      , const cl::Event &event);
+  // host code of `stage` that ran from `begin` (from now()) until now
+  void host(const char *stage, double begin);
+  // closes the frame. commands that have not completed yet move on to the
+  // next one
+  void end_frame();
+  // run and wait times of each stage over the last frames
+  void print_stats();
+  void write_trace(const std::string &filename);
+};
+
+// times the host code in its scope as `stage`, when there is a profiler
+class profile_scope {
+  frame_profiler *_profiler;
+  const char *_stage;
+  double _begin;
+public:
+  profile_scope(frame_profiler *profiler, const char *stage)
+    : _profiler(profiler)
+    , _stage(stage)
+    , _begin(profiler ? profiler->now() : 0.) {
+  }
+  ~profile_scope() {
+    if (_profiler)
+      _profiler->host(_stage, _begin);
+  }
+};
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "scene.hh"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class frame_profiler;
+
+// where paths get their random numbers from. all converge to the same image,
+// the low discrepancy ones with less noise for the same samples
+enum class sampler_type {
+  random, // white noise
+  sobol, // Owen-scrambled Sobol points, scrambled differently per pixel
+  // the same Sobol points for every pixel, shifted by blue noise, which
+  // leaves the noise of the first samples in high frequencies
+  blue_noise
+};
+
+// side of the square tiles adaptive sampling works on and OpenCL launches go
+// over, a power of two
+static const int tile_size = 16;
+// samples per pixel everything gets before errors are trusted
+static const int adaptive_warmup_spp = 16;
+// a tile gets at most this many times the samples asked for in one launch
+static const int adaptive_max_boost = 16;
+// passes of the denoiser's a-trous filter, each with taps twice as far apart
+// as the one before
+static const int denoise_passes = 5;
+// how far from a pixel what the denoiser makes of it takes pixels from: the
+// taps of its passes, the 3x3 blur of variances in each and the 7x7 pixels
+// of denoise_input_kernel
+static const int denoise_radius = 2 * ((1 << denoise_passes) - 1)
+  + denoise_passes + 3;
+// samples of earlier frames that temporal reuse keeps at most, so that new
+// samples weigh in with samples / (temporal_max_spp + samples)
+static const int temporal_max_spp = 128;
+
+// a progressive path tracer producing a width x height image. any change to
+// the scene (a commit), its camera or the bounce count between calls to
+// render() restarts accumulation, unless temporal reuse carries it over
+class renderer {
+public:
+  virtual ~renderer() {}
+  // adds `samples` paths per pixel to the image and waits for them
+  virtual void render(const scene &world, int samples, int bounces) = 0;
+  // 8-bit sRGB image, radiance above 1 clipped
+  virtual void read_rgba8(std::vector<uint8_t> *rgba) = 0;
+  // linear average radiance, denoised when denoising
+  virtual void read_radiance(std::vector<float> *rgba) = 0;
+  virtual unsigned long long int get_accumulated_samples() = 0;
+  // switches between tracing each path in one go and tracing all of them a
+  // bounce at a time. both give the same image
+  virtual void set_wavefront(bool wavefront) = 0;
+  // once every pixel has a few samples, further ones only go to tiles whose
+  // estimated relative error is above `threshold`, keeping the number of
+  // samples per launch. 0 samples every pixel alike
+  virtual void set_adaptive(float threshold) = 0;
+  // next event estimation towards emissive spheres, on by default. the
+  // image converges to the same either way, only much faster with it
+  virtual void set_nee(bool nee) = 0;
+  // counts the rays traced, paths' segments and shadow rays, from now on.
+  // for benchmarks, it may slow rendering down
+  virtual void set_count_rays(bool count) = 0;
+  // blue_noise by default
+  virtual void set_sampler(sampler_type sampler) = 0;
+  // filters the image after every launch, guided by the albedo, normal and
+  // depth of what each pixel sees first, so that a few samples per pixel
+  // look like many. accumulation goes on unfiltered. off by default
+  virtual void set_denoise(bool denoise) = 0;
+  // when a commit only moved spheres or the camera moved, pixels keep the
+  // samples of the pixel that saw the same point before instead of starting
+  // over, blended with new ones in a moving average. parts of the image
+  // that nothing moved in stay converged, lighting that changed with the
+  // motion lags a little behind. off by default
+  virtual void set_temporal(bool temporal) = 0;
+  // makes the image the part of a full_width x full_height one whose first
+  // pixel is at (x, y), for rendering images too large for one go in
+  // pieces. the part may stick out of the full image. the whole image by
+  // default, changing it restarts accumulation
+  virtual void set_view(int x, int y, int full_width, int full_height) = 0;
+  // rays traced since counting was switched on
+  virtual unsigned long long int get_ray_count() = 0;
+  // renders with kernels compiled for the current samples, bounces and
+  // image size, which the compiler can unroll and fold constants in. they
+  // are built in the background, the generic kernels render until they are
+  // ready unless `wait`. a no-op without kernels to compile
+  virtual void set_specialise(bool specialise, bool wait) = 0;
+  // device or implementation, for reports
+  virtual std::string get_name() = 0;
+  // times the stages of every frame in `profiler` from now on, nullptr
+  // stops. the caller closes frames with end_frame() after render()
+  virtual void set_profiler(frame_profiler *profiler) = 0;
+};
+
+// turns accumulated (sum of radiance, sample count) pixels into averages
+inline void resolve_accum(float *rgba, size_t pixels) {
+  for (size_t i = 0; i < pixels * 4; i += 4) {
+    float n = rgba[i + 3];
+    for (int c = 0; c < 3; c++)
+      rgba[i + c] = n > 0.f ? rgba[i + c] / n : 0.f;
+    rgba[i + 3] = 1.f;
+  }
+}
+
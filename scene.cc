@@ -0,0 +1,175 @@
+#include "scene.hh"
+#include "obj.hh"
+#include "utils.hh"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <random>
+
+scene::scene()
+  : cam_position(_float3(0.f, 0.1f, 2.f))
+  , version(0)
+  , mesh_version(0) {
+}
+
+void scene::_update_sphere(int i) {
+  const Sphere &s = spheres[i];
+  for (int a = 0; a < 3; a++) {
+    _bounds[i].min[a] = s.position.s[a] - s.radius;
+    _bounds[i].max[a] = s.position.s[a] + s.radius;
+  }
+  sphere_geometry[i] = {{ s.position.s[0], s.position.s[1], s.position.s[2]
+    , s.radius * s.radius }};
+}
+
+void scene::build() {
+  _bounds.resize(spheres.size());
+  sphere_geometry.resize(spheres.size());
+  sphere_materials.resize(spheres.size());
+  for (size_t i = 0; i < spheres.size(); i++) {
+    _update_sphere(i);
+    sphere_materials[i] = { spheres[i].color, spheres[i].emission };
+  }
+  sphere_bvh.build(_bounds);
+  _changed.clear();
+  _changes.clear();
+
+  lights.clear();
+  for (size_t i = 0; i < spheres.size(); i++) {
+    const cl_float3 &e = spheres[i].emission;
+    if (e.s[0] > 0.f || e.s[1] > 0.f || e.s[2] > 0.f)
+      lights.push_back((cl_int)i);
+  }
+
+  std::vector<aabb> triangle_bounds(triangles.size());
+  for (size_t i = 0; i < triangles.size(); i++) {
+    triangle_bounds[i].reset();
+    for (int corner = 0; corner < 3; corner++)
+      triangle_bounds[i].grow(vertices[triangles[i].s[corner]].s);
+  }
+  triangle_bvh.build(triangle_bounds);
+
+  ++version;
+  ++mesh_version;
+}
+
+void scene::add_obj(const std::string &filename, const float min[3]
+    , const float max[3], const Material &material) {
+  size_t first_vertex = vertices.size();
+  load_obj(filename, (int)materials.size(), &vertices, &triangles);
+  materials.push_back(material);
+  if (vertices.size() == first_vertex)
+    die("no vertices in \"%s\"", filename.c_str());
+
+  aabb bounds;
+  bounds.reset();
+  for (size_t i = first_vertex; i < vertices.size(); i++)
+    bounds.grow(vertices[i].s);
+  float scale = FLT_MAX;
+  for (int a = 0; a < 3; a++)
+    if (bounds.max[a] > bounds.min[a])
+      scale = std::min(scale
+          , (max[a] - min[a]) / (bounds.max[a] - bounds.min[a]));
+  if (scale == FLT_MAX)
+    scale = 1.f;
+  // centred in x and z, standing on the bottom of the box in y
+  float offset[3];
+  for (int a = 0; a < 3; a++)
+    offset[a] = a == 1 ? min[a] - bounds.min[a] * scale
+      : (min[a] + max[a] - (bounds.min[a] + bounds.max[a]) * scale) * 0.5f;
+  for (size_t i = first_vertex; i < vertices.size(); i++)
+    for (int a = 0; a < 3; a++)
+      vertices[i].s[a] = vertices[i].s[a] * scale + offset[a];
+}
+
+void scene::sphere_changed(int i) {
+  _changed.push_back(i);
+}
+
+void scene::commit() {
+  if (_changed.empty())
+    return;
+  // renderers more than this many commits behind upload everything
+  const size_t max_changes = 16;
+  for (int i : _changed)
+    _update_sphere(i);
+  ++version;
+  _changes.push_back({ version, _changed, {} });
+  sphere_bvh.refit(_bounds, _changed, &_changes.back().sphere_nodes);
+  if (_changes.size() > max_changes)
+    _changes.pop_front();
+  _changed.clear();
+}
+
+bool scene::get_changes(unsigned long long int since
+    , std::vector<int> *spheres, std::vector<int> *sphere_nodes) const {
+  spheres->clear();
+  sphere_nodes->clear();
+  if (since == version)
+    return true;
+  // the log has to reach back to the first commit after `since`
+  if (_changes.empty() || since > version
+      || _changes.front().version > since + 1)
+    return false;
+  for (const change &c : _changes)
+    if (c.version > since) {
+      spheres->insert(spheres->end(), c.spheres.begin(), c.spheres.end());
+      sphere_nodes->insert(sphere_nodes->end(), c.sphere_nodes.begin()
+          , c.sphere_nodes.end());
+    }
+  return true;
+}
+
+static void make_cornell_box(scene *s) {
+  s->spheres = {
+    Sphere(200.f, _float3(-200.6f, 0.0f, 0.0f),   _float3(0.75f, 0.25f, 0.25f), _float3(0, 0, 0)),
+    Sphere(200.f, _float3(200.6f, 0.0f, 0.0f),    _float3(0.25f, 0.25f, 0.75f), _float3(0, 0, 0)),
+    Sphere(200.f, _float3(0.0f, -200.4f, 0.0f),   _float3(0.9f, 0.8f, 0.7f),    _float3(0, 0, 0)),
+    Sphere(200.f, _float3(0.0f, 200.4f, 0.0f),    _float3(0.9f, 0.8f, 0.7f),    _float3(0, 0, 0)),
+    Sphere(200.f, _float3(0.0f, 0.0f, -200.4f),   _float3(0.9f, 0.8f, 0.7f),    _float3(0, 0, 0)),
+    Sphere(200.f, _float3(0.0f, 0.0f, 202.0f),    _float3(0.9f, 0.8f, 0.7f),    _float3(0, 0, 0)),
+    Sphere(0.16f, _float3(-0.25f, -0.24f, -0.1f), _float3(0.9f, 0.8f, 0.7f),    _float3(0, 0, 0)),
+    Sphere(0.16f, _float3(0.25f, -0.24f, 0.1f),   _float3(0.9f, 0.8f, 0.7f),    _float3(0, 0, 0)),
+    Sphere(  1.f, _float3(0.0f, 1.36f, 0.0f),     _float3(0.0f, 0.0f, 0.0f),    _float3(9.0f, 8.0f, 6.0f))
+  };
+}
+
+// fills the lower half of the box with `count` spheres of random colour,
+// sized so that they take up a few percent of the volume and light still gets
+// through. the seed is fixed so that the same count always gives the same
+// scene
+static void add_sphere_field(scene *s, int count) {
+  const float min[3] = { -0.58f, -0.38f, -0.38f }
+    , max[3] = { 0.58f, 0.f, 0.6f };
+  float volume = (max[0] - min[0]) * (max[1] - min[1]) * (max[2] - min[2])
+    , radius = 0.25f * std::cbrt(volume / count);
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> uniform(0.f, 1.f);
+  s->spheres.reserve(s->spheres.size() + count);
+  for (int i = 0; i < count; i++) {
+    cl_float3 position, color;
+    for (int a = 0; a < 3; a++)
+      position.s[a] = min[a] + uniform(rng) * (max[a] - min[a]);
+    for (int c = 0; c < 3; c++)
+      color.s[c] = 0.2f + 0.7f * uniform(rng);
+    s->spheres.push_back(Sphere(radius, position, color, _float3(0, 0, 0)));
+  }
+}
+
+void load_scene(const std::string &name, scene *s) {
+  make_cornell_box(s);
+  if (name.compare(0, 8, "spheres:") == 0) {
+    int count = atoi(name.c_str() + 8);
+    if (count <= 0)
+      die("invalid sphere count in scene \"%s\"", name.c_str());
+    add_sphere_field(s, count);
+  } else if (name.compare(0, 4, "obj:") == 0) {
+    // in front of the two spheres, leaving room for the animated one
+    const float min[3] = { -0.2f, -0.4f, 0.15f }, max[3] = { 0.2f, 0.f, 0.55f };
+    Material material = { _float3(0.9f, 0.8f, 0.7f), _float3(0, 0, 0) };
+    s->add_obj(name.substr(4), min, max, material);
+  } else if (name != "cornell")
+    die("unknown scene \"%s\"", name.c_str());
+  s->build();
+}
+
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "bvh.hh"
+#include <CL/cl.hpp>
+#include <deque>
+#include <string>
+#include <vector>
+
+// how scenes are made. renderers trace the packed copies in the scene's
+// sphere_geometry and sphere_materials instead
+struct Sphere {
+  cl_float radius;
+  cl_float3 position;
+  cl_float3 color;
+  cl_float3 emission;
+  Sphere(cl_float n_radius, cl_float3 n_position, cl_float3 n_color
+      , cl_float3 n_emission)
+    : radius(n_radius)
+    , position(n_position)
+    , color(n_color)
+    , emission(n_emission) {
+  }
+};
+
+#define _float3(x, y, z) {{ x, y, z }} // macro to replace ugly initializer braces
+
+// surface shared by the triangles of a mesh
+struct Material {
+  cl_float3 color;
+  cl_float3 emission;
+};
+
+class scene {
+  // what a commit changed, kept for a few versions so that renderers can
+  // upload just that
+  struct change {
+    unsigned long long int version;
+    std::vector<int> spheres, sphere_nodes;
+  };
+  std::vector<aabb> _bounds;
+  std::vector<int> _changed;
+  std::deque<change> _changes;
+
+  void _update_sphere(int i);
+public:
+  std::vector<Sphere> spheres;
+  // what tracing reads of the spheres, up to date after build() and
+  // commit(): position in xyz and radius squared in w, all that intersection
+  // tests need, and apart from that the materials, only needed on a hit
+  std::vector<cl_float4> sphere_geometry;
+  std::vector<Material> sphere_materials;
+  cl_float3 cam_position;
+  bvh sphere_bvh;
+  // indices of the emissive spheres, updated by build()
+  std::vector<cl_int> lights;
+  // triangle meshes in indexed form: positions in xyz of `vertices`, and for
+  // each triangle its three vertex indices plus a material index in w
+  std::vector<cl_float4> vertices;
+  std::vector<cl_int4> triangles;
+  std::vector<Material> materials;
+  bvh triangle_bvh;
+  // bumped by every commit so renderers know when to upload it again
+  unsigned long long int version;
+  // meshes never move, they only change (and need uploading) on build()
+  unsigned long long int mesh_version;
+
+  scene();
+  // builds the bvhs from scratch, needed after adding or removing spheres or
+  // triangles
+  void build();
+  // loads a .obj mesh and scales it uniformly to fit into the box from
+  // `min` to `max`, touching its bottom
+  void add_obj(const std::string &filename, const float min[3]
+      , const float max[3], const Material &material);
+  // call after moving or resizing a sphere. other changes to it need a
+  // build()
+  void sphere_changed(int i);
+  // refits the bvh over spheres changed since the last commit
+  void commit();
+  // indices of the spheres and sphere bvh nodes changed by the commits after
+  // `since`, unsorted and possibly repeated. false if everything may have
+  // changed, after a build() or when `since` is too old
+  bool get_changes(unsigned long long int since, std::vector<int> *spheres
+      , std::vector<int> *sphere_nodes) const;
+};
+
+// "cornell" is the classic box, "spheres:N" the same box filled with N
+// small random spheres and "obj:FILE" the box with the mesh from FILE
+// standing on the floor. the first 9 spheres are the same in all of them
+void load_scene(const std::string &name, scene *s);
+
@@ -0,0 +1,119 @@
+#include "scene_buffer.hh"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+// zero-copy memory is page aligned, as OpenCL implementations want it for
+// using it in place
+static const size_t page_size = 4096;
+
+scene_buffer::scene_buffer()
+  : _zero_copy(false)
+  , _mapped(nullptr)
+  , _host(nullptr, free)
+  , _capacity(0)
+  , _size(0) {
+}
+
+scene_buffer::~scene_buffer() {
+  _unmap();
+}
+
+void scene_buffer::init(const cl::Context &context
+    , const cl::CommandQueue &queue, bool zero_copy) {
+  _context = context;
+  _queue = queue;
+  _zero_copy = zero_copy;
+}
+
+void scene_buffer::_unmap() {
+  if (!_mapped)
+    return;
+  if (_upload())
+    _upload.wait();
+  _queue.enqueueUnmapMemObject(_staging, _mapped);
+  _mapped = nullptr;
+}
+
+void scene_buffer::upload(const void *data, size_t size
+    , const std::vector<range> *dirty
+    , const std::function<void(const cl::Event&)> &enqueued) {
+  if (size > _capacity || _capacity == 0) {
+    _unmap();
+    if (_zero_copy) {
+      // kernels may still read the old memory
+      _queue.finish();
+      _capacity = std::max<size_t>((size + page_size - 1) / page_size, 1)
+        * page_size;
+      _host.reset((char*)aligned_alloc(page_size, _capacity));
+      _buffer = cl::Buffer(_context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR
+          , _capacity, _host.get());
+    } else {
+      _capacity = std::max<size_t>(size, 16);
+      _buffer = cl::Buffer(_context, CL_MEM_READ_ONLY, _capacity);
+      _staging = cl::Buffer(_context, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR
+          , _capacity);
+      _mapped = (char*)_queue.enqueueMapBuffer(_staging, CL_TRUE
+          , CL_MAP_WRITE, 0, _capacity);
+      _upload = cl::Event();
+    }
+    dirty = nullptr;
+  }
+  if (size != _size)
+    dirty = nullptr;
+  _size = size;
+  std::vector<range> all;
+  if (!dirty) {
+    all.push_back({ 0, size });
+    dirty = &all;
+  }
+
+  const char *src = (const char*)data;
+  if (_zero_copy) {
+    // mapping waits for the kernels still reading the buffer, and on a CPU
+    // device is all it takes for the writes to be seen
+    for (const range &r : *dirty) {
+      if (r.begin >= r.end)
+        continue;
+      cl::Event map, unmap;
+      void *dst = _queue.enqueueMapBuffer(_buffer, CL_TRUE
+          , CL_MAP_WRITE_INVALIDATE_REGION, r.begin, r.end - r.begin, nullptr
+          , &map);
+      memcpy(dst, src + r.begin, r.end - r.begin);
+      _queue.enqueueUnmapMemObject(_buffer, dst, nullptr, &unmap);
+      enqueued(map);
+      enqueued(unmap);
+    }
+    return;
+  }
+  // the previous upload may still be reading what is about to change
+  if (_upload())
+    _upload.wait();
+  for (const range &r : *dirty) {
+    if (r.begin >= r.end)
+      continue;
+    memcpy(_mapped + r.begin, src + r.begin, r.end - r.begin);
+    _queue.enqueueWriteBuffer(_buffer, CL_FALSE, r.begin, r.end - r.begin
+        , _mapped + r.begin, nullptr, &_upload);
+    enqueued(_upload);
+  }
+}
+
+const cl::Buffer& scene_buffer::get() const {
+  return _buffer;
+}
+
+std::vector<scene_buffer::range> scene_buffer::ranges(std::vector<int> indices
+    , size_t element_size) {
+  // a separate transfer costs more than a few elements more in one
+  const int max_gap = 4;
+  std::sort(indices.begin(), indices.end());
+  std::vector<range> result;
+  for (size_t i = 0; i < indices.size(); ) {
+    int first = indices[i], last = first;
+    for (; i < indices.size() && indices[i] - last <= max_gap; i++)
+      last = indices[i];
+    result.push_back({ first * element_size, (last + 1) * element_size });
+  }
+  return result;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <CL/cl.hpp>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// a device copy of a host array of scene data that is kept up to date by
+// uploading only the parts that changed. uploads go through pinned host
+// memory that stays mapped, so that they are DMA transfers and not copies
+// from pageable memory. on CPU devices the buffer is host memory that the
+// device uses in place
+class scene_buffer {
+  cl::Context _context;
+  cl::CommandQueue _queue;
+  bool _zero_copy;
+  cl::Buffer _buffer;
+  // pinned memory (CL_MEM_ALLOC_HOST_PTR) mapped at _mapped for as long as
+  // it exists
+  cl::Buffer _staging;
+  char *_mapped;
+  // what a zero-copy buffer uses
+  std::unique_ptr<char, void (*)(void*)> _host;
+  size_t _capacity, _size;
+  // the last upload from _mapped, which must complete before it is written
+  cl::Event _upload;
+
+  void _unmap();
+public:
+  struct range {
+    size_t begin, end; // in bytes
+  };
+
+  scene_buffer();
+  ~scene_buffer();
+  // to be called once before uploading. zero_copy is for devices that
+  // share the host's memory
+  void init(const cl::Context &context, const cl::CommandQueue &queue
+      , bool zero_copy);
+  // makes the buffer hold `size` bytes of `data`. only the byte ranges in
+  // `dirty` are uploaded if given and the size is unchanged, everything
+  // otherwise. `enqueued` is told about every command queued
+  void upload(const void *data, size_t size, const std::vector<range> *dirty
+      , const std::function<void(const cl::Event&)> &enqueued);
+  // not null after the first upload, even of nothing, since kernel arguments
+  // cannot be
+  const cl::Buffer& get() const;
+
+  // the byte ranges of the elements at `indices`, merged where they are
+  // close so that there are fewer and larger transfers
+  static std::vector<range> ranges(std::vector<int> indices
+      , size_t element_size);
+};
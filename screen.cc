@@ -10,6 +10,7 @@ screen::screen(const std::string &n_title, int n_window_width
   , _window_width(n_window_width)
   , _window_height(n_window_height)
   , _frame_idx(0)
+  , _draw_ms(0.)
   , running(true) {
   assertf(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER) == 0
       , "failed to init sdl: %s", SDL_GetError());
@@ -41,11 +42,16 @@ screen::~screen() {
 static char sdlkey_to_char(const SDL_Keycode &kc) {
   switch (kc) {
     case SDLK_a: return 'a';
+    case SDLK_b: return 'b';
     case SDLK_c: return 'c';
     case SDLK_d: return 'd';
     case SDLK_f: return 'f';
+    case SDLK_m: return 'm';
+    case SDLK_n: return 'n';
+    case SDLK_p: return 'p';
     case SDLK_q: return 'q';
     case SDLK_s: return 's';
+    case SDLK_t: return 't';
     case SDLK_w: return 'w';
     case SDLK_x: return 'x';
     case SDLK_z: return 'z';
@@ -122,6 +128,7 @@ void screen::mainloop(void (*load_cb)(void)
       - draw_begin_w;
     float draw_duration_c = ((float)(draw_end_c - draw_begin_c) / CLOCKS_PER_SEC)
       * 1000.f;
+    _draw_ms = draw_duration_w.count();
 
     SDL_GL_SwapWindow(_window);
 
@@ -174,3 +181,7 @@ unsigned long long int screen::get_frame_idx() {
   return _frame_idx;
 }
 
+double screen::get_draw_ms() {
+  return _draw_ms;
+}
+
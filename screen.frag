@@ -1,11 +1,30 @@
 #version 330
 
+// linear radiance
 uniform sampler2D tex;
+// in stops, the radiance is scaled by 2^exposure
+uniform float exposure;
+// how radiance above 1 is brought into range: 0 clips it, 1 is Reinhard's
+// operator on luminance, 2 the ACES filmic curve as fitted by Narkowicz
+uniform int tone_map;
 in vec2 texcoord_f;
 
 out vec4 frag_color;
 
-void main() {
-  frag_color = texture2D(tex, texcoord_f);
+float luminance(vec3 c) {
+  return dot(c, vec3(0.2126, 0.7152, 0.0722));
+}
+
+vec3 linear_to_srgb(vec3 c) {
+  return mix(c * 12.92, 1.055 * pow(c, vec3(1.0 / 2.4)) - 0.055
+      , greaterThanEqual(c, vec3(0.0031308)));
 }
 
+void main() {
+  vec3 c = max(texture(tex, texcoord_f).rgb, 0.0) * exp2(exposure);
+  if (tone_map == 1)
+    c /= 1.0 + luminance(c);
+  else if (tone_map == 2)
+    c = c * (2.51 * c + 0.03) / (c * (2.43 * c + 0.59) + 0.14);
+  frag_color = vec4(linear_to_srgb(clamp(c, 0.0, 1.0)), 1.0);
+}
@@ -12,6 +12,7 @@ class screen {
   int _pre_lock_mouse_x, _pre_lock_mouse_y;
   int _window_width, _window_height;
   unsigned long long int _frame_idx;
+  double _draw_ms;
 public:
   bool running;
 
@@ -30,6 +31,8 @@ public:
   int get_window_width();
   int get_window_height();
   unsigned long long int get_frame_idx();
+  // wall time the last call of draw_cb took, 0 before the first
+  double get_draw_ms();
 };
 
 extern screen *g_screen;
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+// ray packets are SIMD_WIDTH lanes wide: 8 when compiled for avx (e.g. with
+// -mavx2 or -march=native), 4 otherwise
+#if defined(__AVX__)
+#include <immintrin.h>
+#define SIMD_WIDTH 8
+#else
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+#define SIMD_WIDTH 4
+#endif
+
+// gcc vector extensions, so that plain arithmetic and comparisons compile to
+// sse or avx. comparisons give vint masks with all bits set in the lanes
+// where they hold
+typedef float vfloat __attribute__((vector_size(SIMD_WIDTH * 4)));
+typedef int32_t vint __attribute__((vector_size(SIMD_WIDTH * 4)));
+
+inline vfloat splat(float f) {
+  return vfloat{} + f;
+}
+
+inline vint splat(int32_t i) {
+  return vint{} + i;
+}
+
+inline vfloat select(vint mask, vfloat a, vfloat b) {
+  return (vfloat)((mask & (vint)a) | (~mask & (vint)b));
+}
+
+inline vint select(vint mask, vint a, vint b) {
+  return (mask & a) | (~mask & b);
+}
+
+// like fmin and fmax, a nan operand is ignored. rays parallel to a box face
+// give 0 * inf there
+inline vfloat vmin(vfloat a, vfloat b) {
+  return select((a < b) | (b != b), a, b);
+}
+
+inline vfloat vmax(vfloat a, vfloat b) {
+  return select((a > b) | (b != b), a, b);
+}
+
+inline vfloat vabs(vfloat a) {
+  return (vfloat)((vint)a & splat(0x7fffffff));
+}
+
+inline vfloat vsqrt(vfloat a) {
+#if SIMD_WIDTH == 8
+  return (vfloat)_mm256_sqrt_ps((__m256)a);
+#elif defined(__SSE__)
+  return (vfloat)_mm_sqrt_ps((__m128)a);
+#else
+  for (int i = 0; i < SIMD_WIDTH; i++)
+    a[i] = std::sqrt(a[i]);
+  return a;
+#endif
+}
+
+// one bit per lane of a mask
+inline int movemask(vint mask) {
+#if SIMD_WIDTH == 8
+  return _mm256_movemask_ps((__m256)mask);
+#elif defined(__SSE__)
+  return _mm_movemask_ps((__m128)mask);
+#else
+  int bits = 0;
+  for (int i = 0; i < SIMD_WIDTH; i++)
+    if (mask[i])
+      bits |= 1 << i;
+  return bits;
+#endif
+}
+
+// whether any lane of a mask is set
+inline bool any(vint mask) {
+  return movemask(mask) != 0;
+}
+
+// how many lanes of a mask are set
+inline int count(vint mask) {
+  return __builtin_popcount(movemask(mask));
+}
+
+struct vfloat3 {
+  vfloat x, y, z;
+};
+
+inline vfloat3 splat3(const float v[3]) {
+  return { splat(v[0]), splat(v[1]), splat(v[2]) };
+}
+
+inline vfloat3 operator+(const vfloat3 &a, const vfloat3 &b) {
+  return { a.x + b.x, a.y + b.y, a.z + b.z };
+}
+
+inline vfloat3 operator-(const vfloat3 &a, const vfloat3 &b) {
+  return { a.x - b.x, a.y - b.y, a.z - b.z };
+}
+
+inline vfloat dot(const vfloat3 &a, const vfloat3 &b) {
+  return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+inline vfloat3 cross(const vfloat3 &a, const vfloat3 &b) {
+  return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z
+    , a.x * b.y - a.y * b.x };
+}
+
@@ -0,0 +1,190 @@
+#include "split_renderer.hh"
+#include "utils.hh"
+#include <algorithm>
+#include <cmath>
+
+split_renderer::split_renderer(const std::vector<ocl_device> &devices
+    , int width, int height)
+  : _throughput(devices.size(), 0.)
+  , _width(width)
+  , _height(height) {
+  assertf(height >= (int)devices.size(), "cannot split %d rows between %zu "
+      "devices", height, devices.size());
+  for (const ocl_device &d : devices)
+    _renderers.push_back(new cl_renderer(d.platform, d.device, width, height
+          , {}));
+  // start with equal bands until there are timings
+  for (size_t i = 0; i <= devices.size(); i++)
+    _bands.push_back((int)(i * height / devices.size()));
+}
+
+split_renderer::~split_renderer() {
+  for (cl_renderer *r : _renderers)
+    delete r;
+}
+
+void split_renderer::_rebalance(bool migrate) {
+  const double smoothing = 0.3;
+  size_t n = _renderers.size();
+  for (size_t i = 0; i < n; i++) {
+    int rows = _bands[i + 1] - _bands[i];
+    double ms = _renderers[i]->get_kernel_ms();
+    if (rows <= 0 || ms <= 0)
+      continue;
+    if (_throughput[i] == 0)
+      _throughput[i] = rows / ms;
+    else
+      _throughput[i] += smoothing * (rows / ms - _throughput[i]);
+  }
+
+  double total = 0;
+  for (double t : _throughput) {
+    if (t == 0) // not measured yet
+      return;
+    total += t;
+  }
+  std::vector<int> bands(n + 1);
+  bands[0] = 0;
+  double acc = 0;
+  for (size_t i = 0; i < n; i++) {
+    acc += _throughput[i];
+    bands[i + 1] = (int)std::lround(acc / total * _height);
+    // every device keeps at least one row so that its timing stays known
+    bands[i + 1] = clamp(bands[i + 1], std::min(bands[i] + 1, _height)
+        , _height - (int)(n - 1 - i));
+  }
+  bands[n] = _height;
+
+  // ignore jitter in the timings so that rows don't move back and forth
+  int max_change = 0;
+  for (size_t i = 0; i <= n; i++)
+    max_change = std::max(max_change, std::abs(bands[i] - _bands[i]));
+  if (max_change <= std::max(1, _height / 100))
+    return;
+
+  if (migrate) {
+    // rows changing hands take their accumulated samples with them
+    for (size_t to = 0; to < n; to++)
+      for (size_t from = 0; from < n; from++) {
+        if (from == to)
+          continue;
+        int y_begin = std::max(bands[to], _bands[from])
+          , y_end = std::min(bands[to + 1], _bands[from + 1]);
+        if (y_begin >= y_end)
+          continue;
+        _renderers[from]->read_accum_rows(y_begin, y_end, _staging.data());
+        _renderers[to]->write_accum_rows(y_begin, y_end, _staging.data());
+        _renderers[from]->read_moment_rows(y_begin, y_end, _staging.data());
+        _renderers[to]->write_moment_rows(y_begin, y_end, _staging.data());
+      }
+  }
+  _bands = bands;
+}
+
+void split_renderer::render(const scene &world, int samples, int bounces) {
+  // a frame that restarts accumulation has nothing worth moving
+  bool reset = _renderers[0]->accum_invalidated(world, bounces);
+  _staging.resize((size_t)_width * _height * 4);
+  _rebalance(!reset);
+
+  for (size_t i = 0; i < _renderers.size(); i++)
+    _renderers[i]->enqueue(world, samples, bounces, _bands[i]
+        , _bands[i + 1]);
+  for (cl_renderer *r : _renderers)
+    r->finish();
+}
+
+void split_renderer::read_rgba8(std::vector<uint8_t> *rgba) {
+  rgba->resize((size_t)_width * _height * 4);
+  for (size_t i = 0; i < _renderers.size(); i++)
+    _renderers[i]->read_rgba8_rows(_bands[i], _bands[i + 1], rgba->data());
+}
+
+void split_renderer::read_radiance(std::vector<float> *rgba) {
+  rgba->resize((size_t)_width * _height * 4);
+  for (size_t i = 0; i < _renderers.size(); i++)
+    _renderers[i]->read_radiance_rows(_bands[i], _bands[i + 1], rgba->data());
+}
+
+unsigned long long int split_renderer::get_accumulated_samples() {
+  // bands converge separately under adaptive sampling, the one still taking
+  // samples counts
+  unsigned long long int samples = _renderers[0]->get_accumulated_samples();
+  for (cl_renderer *r : _renderers)
+    samples = std::max(samples, r->get_accumulated_samples());
+  return samples;
+}
+
+void split_renderer::set_wavefront(bool wavefront) {
+  for (cl_renderer *r : _renderers)
+    r->set_wavefront(wavefront);
+}
+
+void split_renderer::set_adaptive(float threshold) {
+  for (cl_renderer *r : _renderers)
+    r->set_adaptive(threshold);
+}
+
+void split_renderer::set_nee(bool nee) {
+  for (cl_renderer *r : _renderers)
+    r->set_nee(nee);
+}
+
+void split_renderer::set_sampler(sampler_type sampler) {
+  for (cl_renderer *r : _renderers)
+    r->set_sampler(sampler);
+}
+
+void split_renderer::set_denoise(bool denoise) {
+  for (cl_renderer *r : _renderers)
+    r->set_denoise(denoise);
+}
+
+void split_renderer::set_temporal(bool temporal) {
+  for (cl_renderer *r : _renderers)
+    r->set_temporal(temporal);
+}
+
+void split_renderer::set_view(int x, int y, int full_width
+    , int full_height) {
+  for (cl_renderer *r : _renderers)
+    r->set_view(x, y, full_width, full_height);
+}
+
+void split_renderer::set_count_rays(bool count) {
+  for (cl_renderer *r : _renderers)
+    r->set_count_rays(count);
+}
+
+void split_renderer::set_specialise(bool specialise, bool wait) {
+  for (cl_renderer *r : _renderers)
+    r->set_specialise(specialise, wait);
+}
+
+void split_renderer::set_profiler(frame_profiler *profiler) {
+  for (size_t i = 0; i < _renderers.size(); i++)
+    _renderers[i]->set_profiler(profiler, _renderers[i]->get_name() + " ("
+        + std::to_string(i) + ")");
+}
+
+unsigned long long int split_renderer::get_ray_count() {
+  unsigned long long int rays = 0;
+  for (cl_renderer *r : _renderers)
+    rays += r->get_ray_count();
+  return rays;
+}
+
+std::string split_renderer::get_name() {
+  std::string name;
+  for (cl_renderer *r : _renderers)
+    name += (name.empty() ? "" : " + ") + r->get_name();
+  return name;
+}
+
+void split_renderer::print_split() {
+  for (size_t i = 0; i < _renderers.size(); i++)
+    printf("  %-40s rows %4d-%4d, %8.3f ms/launch\n"
+        , _renderers[i]->get_device().getInfo<CL_DEVICE_NAME>().c_str()
+        , _bands[i], _bands[i + 1], _renderers[i]->get_kernel_ms());
+}
+
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "cl_renderer.hh"
+#include "ocl.hh"
+
+// renders every frame on several OpenCL devices at once, each taking a band
+// of rows. band heights follow the throughput measured from each device's
+// kernel time so that all devices finish at about the same time. the bands
+// are merged on the host
+class split_renderer : public renderer {
+  std::vector<cl_renderer*> _renderers;
+  // rows per millisecond of kernel time, smoothed over frames
+  std::vector<double> _throughput;
+  // device i renders rows [_bands[i], _bands[i + 1])
+  std::vector<int> _bands;
+  int _width, _height;
+  std::vector<float> _staging;
+
+  void _rebalance(bool migrate);
+public:
+  split_renderer(const std::vector<ocl_device> &devices, int width
+      , int height);
+  ~split_renderer();
+  void render(const scene &world, int samples, int bounces);
+  void read_rgba8(std::vector<uint8_t> *rgba);
+  void read_radiance(std::vector<float> *rgba);
+  unsigned long long int get_accumulated_samples();
+  void set_wavefront(bool wavefront);
+  void set_adaptive(float threshold);
+  void set_nee(bool nee);
+  void set_sampler(sampler_type sampler);
+  // bands are filtered apart, the filter does not reach across them
+  void set_denoise(bool denoise);
+  void set_temporal(bool temporal);
+  void set_view(int x, int y, int full_width, int full_height);
+  void set_count_rays(bool count);
+  void set_specialise(bool specialise, bool wait);
+  unsigned long long int get_ray_count();
+  std::string get_name();
+  // a track per device
+  void set_profiler(frame_profiler *profiler);
+  void print_split();
+};
+
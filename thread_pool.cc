@@ -0,0 +1,96 @@
+#include "thread_pool.hh"
+#include <algorithm>
+
+thread_pool::thread_pool(int threads)
+  : _job(nullptr)
+  , _generation(0)
+  , _busy(0)
+  , _quit(false) {
+  if (threads <= 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  for (int i = 0; i < threads; i++)
+    _queues.emplace_back(new task_queue);
+  for (int i = 1; i < threads; i++)
+    _threads.emplace_back(&thread_pool::_worker, this, i);
+}
+
+thread_pool::~thread_pool() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _quit = true;
+  }
+  _start.notify_all();
+  for (std::thread &t : _threads)
+    t.join();
+}
+
+int thread_pool::size() const {
+  return (int)_queues.size();
+}
+
+void thread_pool::run(int count, const std::function<void(int, int)> &job) {
+  // neighbouring tasks start out on the same thread
+  int n = size();
+  for (int i = 0; i < n; i++) {
+    std::lock_guard<std::mutex> lock(_queues[i]->mutex);
+    for (int task = (int)((long long)i * count / n)
+        ; task < (int)((long long)(i + 1) * count / n); task++)
+      _queues[i]->tasks.push_back(task);
+  }
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _job = &job;
+    _busy = n - 1;
+    ++_generation;
+  }
+  _start.notify_all();
+
+  _work(0);
+
+  std::unique_lock<std::mutex> lock(_mutex);
+  _done.wait(lock, [this] { return _busy == 0; });
+  _job = nullptr;
+}
+
+void thread_pool::_worker(int index) {
+  unsigned int generation = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _start.wait(lock, [&] { return _quit || _generation != generation; });
+      if (_quit)
+        return;
+      generation = _generation;
+    }
+    _work(index);
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (--_busy == 0)
+      _done.notify_one();
+  }
+}
+
+void thread_pool::_work(int index) {
+  int task;
+  while (_next_task(index, &task))
+    (*_job)(task, index);
+}
+
+bool thread_pool::_next_task(int index, int *task) {
+  int n = size();
+  for (int i = 0; i < n; i++) {
+    task_queue &queue = *_queues[(index + i) % n];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty())
+      continue;
+    if (i == 0) {
+      *task = queue.tasks.front();
+      queue.tasks.pop_front();
+    } else {
+      *task = queue.tasks.back();
+      queue.tasks.pop_back();
+    }
+    return true;
+  }
+  return false;
+}
+
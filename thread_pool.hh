@@ -0,0 +1,41 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// runs batches of independent tasks on a fixed set of threads. every thread
+// has its own queue of tasks, works through it from the front and, once it is
+// empty, steals from the back of the others' so that uneven tasks even out.
+// the thread calling run() is one of the workers
+class thread_pool {
+  struct task_queue {
+    std::mutex mutex;
+    std::deque<int> tasks;
+  };
+  std::vector<std::unique_ptr<task_queue>> _queues;
+  std::vector<std::thread> _threads;
+  std::mutex _mutex;
+  std::condition_variable _start, _done;
+  const std::function<void(int, int)> *_job;
+  unsigned int _generation;
+  int _busy;
+  bool _quit;
+
+  void _worker(int index);
+  void _work(int index);
+  bool _next_task(int index, int *task);
+public:
+  // 0 threads is one per hardware thread
+  explicit thread_pool(int threads = 0);
+  ~thread_pool();
+  int size() const;
+  // calls job(task, thread) for every task in [0, count) and waits for them.
+  // `thread` is in [0, size()) and no two tasks run on the same one at once
+  void run(int count, const std::function<void(int, int)> &job);
+};
+